@@ -2,6 +2,9 @@
 #include <memory>
 #include <dlfcn.h>
 #include <algorithm>
+#include <map>
+#include <set>
+#include "optimizer.h"
 #include "parser.h"
 #include "scope.h"
 
@@ -20,16 +23,49 @@ static inline std::ostream &operator<<(std::ostream &out, BadSymbol bs)
 	return out;
 }
 
+struct BadArity
+{
+	Token token;
+	std::size_t expected;
+	bool atLeast;
+	BadArity(Token t, std::size_t e, bool a = false) : token(t), expected(e), atLeast(a) {}
+};
+
+static inline std::ostream &operator<<(std::ostream &out, BadArity ba)
+{
+	out << ba.token << " requires " << (ba.atLeast ? "at least " : "") << ba.expected << " argument";
+	out << ((ba.expected == 1) ? "" : "s");
+	return out;
+}
+
 struct Analyzer
 {
+	/*
+	 * What a function or a top-level call does besides computing its value:
+	 * whether it touches a global variable or calls a system function, and
+	 * which functions it calls in turn.
+	 */
+	struct Effects
+	{
+		bool impure = false;
+		std::set<std::string> callees;
+	};
+
 	Parser parser;
 	std::size_t varCounter;
 	std::size_t globalVars;
+	std::vector<Value> constants;
+	std::map<std::string, std::size_t> constantIndex;
+	std::map<std::string, Effects> effects;
+	Effects *currentEffects = nullptr;
+	bool optimize = true;
 
 	Analyzer(const char *file) : parser(file), varCounter(0), globalVars(0) {}
 
 	Analyzer(std::string file) : Analyzer(file.c_str()) {}
 
+	Analyzer(Source source) : parser(std::move(source)), varCounter(0), globalVars(0) {}
+
 	void fail(Token token, bool exists)
 	{
 		throw BadSymbol(token, exists);
@@ -38,24 +74,70 @@ struct Analyzer
 	Toplevel toplevel()
 	{
 		auto toplevel = parser.toplevel();
+		analyze(toplevel);
+
+		if (optimize) {
+			Optimizer optimizer(toplevel, parser.stringTable);
+			for (auto pass : optimizer.passes) {
+				(optimizer.*pass)();
+				analyze(toplevel);
+			}
+		}
+		return toplevel;
+	}
+
+private:
+	void analyze(Toplevel &toplevel)
+	{
+		varCounter = 0;
+		globalVars = 0;
+		constants.clear();
+		constantIndex.clear();
+		effects.clear();
 
 		auto currentScope = std::make_shared<Scope>(Scope());
 		toplevel.scope = currentScope;
 
+		std::vector<Effects> callEffects;
 		for (auto & global : toplevel.globals) {
 			global.match([&](Var &v) { var(v, currentScope, true); },
 						 [&](Func &f) { func(f, currentScope); },
-						 [&](Call &c) { call(c, currentScope, false); });
+						 [&](Call &c) {
+							 callEffects.emplace_back();
+							 currentEffects = &callEffects.back();
+							 call(c, currentScope, false);
+							 currentEffects = nullptr;
+						 });
+		}
+
+		auto next = callEffects.begin();
+		for (auto & global : toplevel.globals) {
+			global.match([&](Call &c) {
+				std::set<std::string> visited;
+				c.isIndependent = independent(*next++, visited);
+			});
 		}
 		toplevel.globalVars = globalVars;
-		return toplevel;
+		toplevel.constants = constants;
+	}
+
+	bool independent(const Effects &e, std::set<std::string> &visited)
+	{
+		if (e.impure) {
+			return false;
+		}
+		for (auto &callee : e.callees) {
+			if (visited.insert(callee).second && !independent(effects[callee], visited)) {
+				return false;
+			}
+		}
+		return true;
 	}
 
-private:
 	void define(Identifier &name, Ptr<Scope> currentScope, bool global)
 	{
 		auto n = parser.stringTable.get(name);
-		if (isSysCall(name)) {
+		if (isSysCall(name) || findBuiltin(name.token.text) != nullptr) {
 			fail(name.token, true);
 		}
 		if (!currentScope->add(n, name, (global) ? globalVars : varCounter, global)) {
@@ -84,7 +166,9 @@ private:
 			++varCounter;
 		}
 
+		currentEffects = &(effects[f.name.token.text] = Effects());
 		block(*f.body, funcScope, true);
+		currentEffects = nullptr;
 		f.frameSize = varCounter+1;
 	}
 
@@ -98,8 +182,62 @@ private:
 				[&](For &f) { forStatement(f, currentScope); },
 				[&](Return &r) { returnStatement(r, currentScope); },
 				[&](Call &c) { call(c, currentScope, tailContext); },
-				[&](Operator &o) { oper(o, currentScope, tailContext); });
+				[&](Operator &o) {
+					oper(o, currentScope);
+					o.appends = appends(o, currentScope);
+				});
+		}
+	}
+
+	/*
+	 * (= s (+ s ...)) as a statement can append to s in place, provided the
+	 * appended operands can not change s before it is read.
+	 */
+	bool appends(Operator &op, Ptr<Scope> currentScope)
+	{
+		if (op.token.category != Token::Assign || op.operands.size() != 2 || !isIdentifier(*op.operands[0]) ||
+		    !op.operands[1]->is<Operator>()) {
+			return false;
+		}
+
+		auto &target = op.operands[0]->get<Atom>().get<Identifier>();
+		auto &plus = op.operands[1]->get<Operator>();
+		if (plus.token.category != Token::Plus || plus.operands.empty() || !isIdentifier(*plus.operands[0]) ||
+		    plus.operands[0]->get<Atom>().get<Identifier>().token.text != target.token.text) {
+			return false;
 		}
+
+		auto global = currentScope->getSymbol(parser.stringTable.get(target)).global;
+		return std::none_of(plus.operands.begin() + 1, plus.operands.end(), [&](Ptr<Expression> &operand) {
+			return writes(*operand, target.token.text, global);
+		});
+	}
+
+	bool isIdentifier(Expression &ex)
+	{
+		return ex.is<Atom>() && ex.get<Atom>().is<Identifier>();
+	}
+
+	bool writes(Expression &ex, const std::string &name, bool global)
+	{
+		bool result = false;
+		auto operands = [&](OperBase &o) {
+			for (auto &operand : o.operands) {
+				result = result || writes(*operand, name, global);
+			}
+		};
+
+		ex.match([&](Operator &o) {
+			result = o.token.category == Token::Assign && !o.operands.empty() && isIdentifier(*o.operands[0]) &&
+			         o.operands[0]->get<Atom>().get<Identifier>().token.text == name;
+			operands(o);
+		},
+		[&](Call &c) {
+			// only a function can see a global, Read writes its argument
+			result = (global && !c.isSysCall) || c.function.token.text == "Read";
+			operands(c);
+		});
+		return result;
 	}
 
 	void condition(ConditionBase &cb, Ptr<Scope> currentScope)
@@ -164,15 +302,15 @@ private:
 
 	void expression(Expression &exp, Ptr<Scope> currentScope, bool tailContext)
 	{
-		exp.match([&](Operator &o) { oper(o, currentScope, tailContext); },
+		exp.match([&](Operator &o) { oper(o, currentScope); },
 				  [&](Call &c) { call(c, currentScope, tailContext); },
 				  [&](Atom &a) { atom(a, currentScope); });
 	}
 
-	void oper(Operator &op, Ptr<Scope> currentScope, bool tailContext)
+	void oper(Operator &op, Ptr<Scope> currentScope)
 	{
 		for (auto operand : op.operands) {
-			expression(*operand, currentScope, tailContext && operand == op.operands.back());
+			expression(*operand, currentScope, false);
 		}
 	}
 
@@ -189,21 +327,62 @@ private:
 
 	void call(Call &call, Ptr<Scope> currentScope, bool tailContext)
 	{
-		if (isSysCall(call.function)) {
+		if (auto builtin = findBuiltin(call.function.token.text)) {
+			if (call.operands.size() < builtin->arity || (!builtin->variadic && call.operands.size() > builtin->arity)) {
+				throw BadArity(call.function.token, builtin->arity, builtin->variadic);
+			}
+			call.builtin = builtin->kind;
+			// coroutines and worker processes may run any function, a coroutine may outlive the call;
+			// shared segments are created and removed in the system like by a system call
+			if (currentEffects != nullptr && (call.builtin == Builtin::Spawn || call.builtin == Builtin::Await ||
+			                                  call.builtin == Builtin::ForkMap || call.builtin == Builtin::Segment ||
+			                                  call.builtin == Builtin::DropSegment)) {
+				currentEffects->impure = true;
+			}
+		}
+		else if (isSysCall(call.function)) {
 			call.isSysCall = true;
+			if (currentEffects != nullptr) {
+				currentEffects->impure = true;
+			}
 		}
 		else {
 			identifier(call.function, currentScope);
+			if (currentEffects != nullptr) {
+				currentEffects->callees.insert(call.function.token.text);
+			}
 		}
+		// only a call whose value is the value of the function can replace its frame
 		call.isTail = tailContext;
 
 		for (auto operand : call.operands) {
-			expression(*operand, currentScope, tailContext && operand == call.operands.back());
+			expression(*operand, currentScope, false);
 		}
 	}
 
 	void atom(Atom &atom, Ptr<Scope> currentScope)
 	{
-		atom.match([&](Identifier &i) { identifier(i, currentScope); });
+		atom.match([&](Identifier &i) {
+			identifier(i, currentScope);
+			if (currentEffects != nullptr && currentScope->getSymbol(parser.stringTable.get(i)).global) {
+				currentEffects->impure = true;
+			}
+		},
+		           [&](Literal &l) { literal(l); });
+	}
+
+	/*
+	 * String literals are pooled per program: equal literals share one
+	 * String, so evaluating them copies no characters.
+	 */
+	void literal(Literal &l)
+	{
+		l.match([&](String &s) {
+			auto found = constantIndex.emplace(s.str(), constants.size());
+			if (found.second) {
+				constants.push_back(s);
+			}
+			s = constants[found.first->second].get<String>();
+		});
 	}
 };
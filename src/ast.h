@@ -2,7 +2,9 @@
 #include <memory>
 #include <vector>
 #include <brick-types>
+#include "builtins.h"
 #include "lexer.h"
+#include "value.h"
 
 using brick::types::Union;
 
@@ -18,7 +20,7 @@ struct Identifier
 	Identifier() : token(Token::Eof, "", 0) {}
 };
 
-using Literal = Union<std::string, int>;
+using Literal = Value;
 
 using Atom = Union<Identifier, Literal>;
 
@@ -30,13 +32,17 @@ struct OperBase
 struct Call : OperBase
 {
 	Identifier function;
-	bool isTail;
-	bool isSysCall;
+	bool isTail = false;
+	bool isSysCall = false;
+	// a top-level call which can run alongside the others
+	bool isIndependent = false;
+	Builtin::Kind builtin = Builtin::None;
 };
 
 struct Operator : OperBase
 {
 	Token token = {Token::Eof, "", 0};
+	bool appends = false;
 };
 
 using ExprBase = Union<Operator, Call, Atom>;
@@ -73,6 +79,8 @@ struct For
 	Ptr<Expression> to;
 	Ptr<Block> body;
 	bool downto;
+	// pfor, the iterations run in parallel
+	bool parallel = false;
 };
 
 struct Return
@@ -108,13 +116,41 @@ struct Toplevel
 	std::vector<Global> globals;
 	Ptr<Scope> scope;
 	std::size_t globalVars;
+	std::vector<Value> constants;
 };
 
 inline std::ostream &operator<<(std::ostream &out, Expression ex);
 
 inline std::ostream &operator<<(std::ostream &out, Literal l) {
-	l.match([&](std::string s) { out << "\"" << s << "\""; },
-		[&](int i) { out << i; });
+	l.match([&](String s) { out << "\"" << s << "\""; },
+		[&](Integer i) { out << i; },
+		[&](Array a) {
+			Visiting visiting(a.identity());
+			if (visiting.repeated) {
+				out << "[...]";
+				return;
+			}
+			out << "[";
+			for (std::size_t i = 0; i < a.elements().size(); i++) {
+				out << (i ? ", " : "") << a.elements()[i];
+			}
+			out << "]";
+		},
+		[&](Map m) {
+			Visiting visiting(m.identity());
+			if (visiting.repeated) {
+				out << "{...}";
+				return;
+			}
+			out << "{";
+			auto keys = m.keys();
+			for (std::size_t i = 0; i < keys.size(); i++) {
+				out << (i ? ", " : "") << keys[i] << ": " << *m.find(keys[i]);
+			}
+			out << "}";
+		},
+		[&](Channel c) { out << "<channel of " << c.size() << ">"; },
+		[&](Segment s) { out << "<shared " << s.name() << " of " << s.size() << ">"; });
 	return out;
 }
 
@@ -199,7 +235,7 @@ inline std::ostream &operator<<(std::ostream &out, While w) {
 }
 
 inline std::ostream &operator<<(std::ostream &out, For f) {
-	out << "for (var " << f.variable << " from ";
+	out << (f.parallel ? "pfor" : "for") << " (var " << f.variable << " from ";
 	operatorCheck(out, *f.from);
 	out << ((f.downto) ? " downto " : " to ");
 	operatorCheck(out, *f.to);
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Limits of a single run, zero stands for no limit: the number of executed
+ * statements, the depth of calls, the wall-clock time and the bytes of
+ * memory, which are counted apart from the budget.
+ */
+struct Limits
+{
+	std::uint64_t statements = 0;
+	std::size_t depth = 0;
+	std::chrono::milliseconds time{0};
+	std::size_t memory = 0;
+
+	// whether the budget has anything to check
+	bool budgeted() const
+	{
+		return statements != 0 || depth != 0 || time.count() != 0;
+	}
+};
+
+/*
+ * What a run has used of its limits, shared by all of its threads. Every
+ * evaluator counts the statements it executes on its own and adds them to
+ * the shared count from time to time, so that threads do not fight over it.
+ */
+struct Budget
+{
+	using Clock = std::chrono::steady_clock;
+
+	Limits limits;
+	Clock::time_point deadline;
+	std::atomic<std::uint64_t> statements{0};
+
+	Budget(Limits limits) : limits(limits), deadline(Clock::now() + limits.time) {}
+};
\ No newline at end of file
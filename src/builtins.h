@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+ * Functions provided by the interpreter itself. They take precedence over
+ * system calls and their arity is checked by the analyzer.
+ */
+struct Builtin
+{
+	enum Kind
+	{
+		None,
+		Array, Get, Set, Len, Push,
+		Map, Put, Lookup, Has, Delete, Keys,
+		Accumulate,
+		Spawn, Await,
+		Chan, ChanSend, ChanRecv, ChanClose,
+		ForkMap,
+		Segment, DropSegment, AtomicAdd, CompareSwap
+	} kind;
+
+	std::string name;
+	std::size_t arity;
+	// takes arity or more arguments
+	bool variadic = false;
+};
+
+inline const std::vector<Builtin> &builtins()
+{
+	static const std::vector<Builtin> table{
+		{Builtin::Array, "Array", 1},
+		{Builtin::Get, "Get", 2},
+		{Builtin::Set, "Set", 3},
+		{Builtin::Len, "Len", 1},
+		{Builtin::Push, "Push", 2},
+		{Builtin::Map, "Map", 0},
+		{Builtin::Put, "Put", 3},
+		{Builtin::Lookup, "Lookup", 2},
+		{Builtin::Has, "Has", 2},
+		{Builtin::Delete, "Delete", 2},
+		{Builtin::Keys, "Keys", 1},
+		{Builtin::Accumulate, "Accumulate", 3},
+		{Builtin::Spawn, "Spawn", 1, true},
+		{Builtin::Await, "Await", 1},
+		{Builtin::Chan, "Chan", 1},
+		{Builtin::ChanSend, "ChanSend", 2},
+		{Builtin::ChanRecv, "ChanRecv", 1},
+		{Builtin::ChanClose, "ChanClose", 1},
+		{Builtin::ForkMap, "ForkMap", 4},
+		{Builtin::Segment, "Segment", 2},
+		{Builtin::DropSegment, "DropSegment", 1},
+		{Builtin::AtomicAdd, "AtomicAdd", 3},
+		{Builtin::CompareSwap, "CompareSwap", 4}
+	};
+	return table;
+}
+
+inline const Builtin *findBuiltin(const std::string &name)
+{
+	for (auto &builtin : builtins()) {
+		if (builtin.name == name) {
+			return &builtin;
+		}
+	}
+	return nullptr;
+}
\ No newline at end of file
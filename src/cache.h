@@ -0,0 +1,623 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <brick-hash>
+#include <brick-mmap>
+#include "ast.h"
+#include "scope.h"
+
+struct BadCache {};
+
+/*
+ * Keeps the analyzed form of a script (the program, its scopes and the
+ * string table) in a binary file next to it. The file starts with the hash
+ * of the source, the format version and the optimizer setting; a cache whose
+ * header does not match is ignored and written anew.
+ *
+ * Numbers are stored as LEB128, token texts once in a table of strings and
+ * scopes once in a table of their own, parents before children.
+ */
+struct ProgramCache
+{
+	// changes whenever the program or the analysis does
+	static const std::uint32_t version = 6;
+
+	std::string path;
+	brick::hash::hash128_t key;
+
+	ProgramCache(const std::string &script, bool optimize) : path(script + ".cache")
+	{
+		std::ifstream in(script, std::ios::binary);
+		std::stringstream source;
+		source << in.rdbuf();
+		auto text = source.str();
+		key = brick::hash::spooky(text.data(), text.size(), version * 2 + optimize);
+	}
+
+	bool load(Toplevel &toplevel, StringTable &stringTable)
+	{
+		brick::mmap::MMap file;
+		try {
+			file.map(path);
+		}
+		catch (brick::mmap::SystemException &) {
+			return false;
+		}
+
+		try {
+			Reader reader(file.cdata(), file.cdata() + file.size());
+			if (reader.number() != magic || reader.number() != key.first || reader.number() != key.second) {
+				return false;
+			}
+			reader.program(toplevel, stringTable);
+			return true;
+		}
+		catch (BadCache) {
+			return false;
+		}
+	}
+
+	// the cache is an optimization only, a file which can not be written is left out
+	void store(Toplevel &toplevel, const StringTable &stringTable)
+	{
+		Writer writer;
+		writer.number(magic);
+		writer.number(key.first);
+		writer.number(key.second);
+		std::string data;
+		try {
+			data = writer.program(toplevel, stringTable);
+		}
+		catch (BadCache) {
+			return;
+		}
+
+		auto temporary = path + ".tmp";
+		std::ofstream out(temporary, std::ios::binary);
+		out.write(data.data(), data.size());
+		out.close();
+		if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+			std::remove(temporary.c_str());
+		}
+	}
+
+private:
+	static const std::uint64_t magic = 0x6568636163707469; // "itpcache"
+
+	enum Tag : std::uint8_t
+	{
+		None,
+		Operator, Call, Identifier, SmallInteger, BigInteger, String,
+		Var, If, While, For, Return, Func
+	};
+
+	struct Writer
+	{
+		std::string out;
+		std::vector<std::string> strings;
+		std::map<std::string, std::size_t> stringIndex;
+		std::vector<const Scope *> scopes;
+		std::map<const Scope *, std::size_t> scopeIndex;
+		std::vector<Value> constants;
+		std::map<std::string, std::size_t> constantIndex;
+
+		void number(std::uint64_t n)
+		{
+			do {
+				std::uint8_t byte = n & 0x7f;
+				n >>= 7;
+				out.push_back(static_cast<char>(n ? (byte | 0x80) : byte));
+			} while (n);
+		}
+
+		void text(const std::string &s)
+		{
+			number(s.size());
+			out.append(s);
+		}
+
+		// what was written so far, the writer starts over
+		std::string take()
+		{
+			std::string result;
+			std::swap(result, out);
+			return result;
+		}
+
+		std::string program(Toplevel &toplevel, const StringTable &stringTable)
+		{
+			auto header = take();
+			constants = toplevel.constants;
+			for (std::size_t i = 0; i < constants.size(); i++) {
+				constantIndex.emplace(constants[i].get<::String>().str(), i);
+			}
+
+			number(toplevel.globals.size());
+			for (auto &global : toplevel.globals) {
+				global.match([&](::Func &f) { func(f); },
+				             [&](::Var &v) { var(v); },
+				             [&](::Call &c) { call(c); });
+			}
+			number(scope(toplevel.scope));
+			number(toplevel.globalVars);
+			auto body = take();
+
+			// the tables are complete only once the program is written
+			number(stringTable.stringTable.size());
+			for (auto &s : stringTable.stringTable) {
+				text(s);
+			}
+			number(constants.size());
+			for (auto &constant : constants) {
+				text(constant.get<::String>().str());
+			}
+			number(scopes.size());
+			for (auto s : scopes) {
+				number(s->parent ? scopeIndex[s->parent.get()] + 1 : 0);
+				number(s->symbolTable.size());
+				for (auto &entry : s->symbolTable) {
+					number(entry.first);
+					token(entry.second.identifier.token);
+					number(entry.second.offset);
+					number(entry.second.global);
+				}
+			}
+			auto tables = take();
+
+			number(strings.size());
+			for (auto &s : strings) {
+				text(s);
+			}
+			return header + take() + tables + body;
+		}
+
+		std::size_t string(const std::string &s)
+		{
+			auto found = stringIndex.emplace(s, strings.size());
+			if (found.second) {
+				strings.push_back(s);
+			}
+			return found.first->second;
+		}
+
+		// 0 stands for no scope
+		std::size_t scope(const Ptr<Scope> &s)
+		{
+			if (s == nullptr) {
+				return 0;
+			}
+			auto found = scopeIndex.find(s.get());
+			if (found != scopeIndex.end()) {
+				return found->second + 1;
+			}
+			scope(s->parent);
+			scopeIndex.emplace(s.get(), scopes.size());
+			scopes.push_back(s.get());
+			return scopes.size();
+		}
+
+		void token(const Token &t)
+		{
+			number(t.category);
+			number(string(t.text));
+			number(t.line);
+		}
+
+		void identifier(::Identifier &i)
+		{
+			token(i.token);
+		}
+
+		void expression(Ptr<Expression> &ex)
+		{
+			if (ex == nullptr) {
+				number(None);
+				return;
+			}
+			ex->match([&](::Operator &o) { oper(o); },
+			          [&](::Call &c) { call(c); },
+			          [&](Atom &a) {
+				a.match([&](::Identifier &i) {
+					number(Identifier);
+					identifier(i);
+				},
+				[&](Literal &l) { literal(l); });
+			});
+		}
+
+		void operands(OperBase &o)
+		{
+			number(o.operands.size());
+			for (auto &operand : o.operands) {
+				expression(operand);
+			}
+		}
+
+		void oper(::Operator &o)
+		{
+			number(Operator);
+			token(o.token);
+			number(o.appends);
+			operands(o);
+		}
+
+		void call(::Call &c)
+		{
+			number(Call);
+			identifier(c.function);
+			number(c.isTail);
+			number(c.isSysCall);
+			number(c.isIndependent);
+			number(c.builtin);
+			operands(c);
+		}
+
+		void literal(Literal &l)
+		{
+			l.match([&](::String &s) {
+				auto found = constantIndex.emplace(s.str(), constants.size());
+				if (found.second) {
+					constants.push_back(s);
+				}
+				number(String);
+				number(found.first->second);
+			},
+			[&](const Integer &i) {
+				if (i.isSmall()) {
+					number(SmallInteger);
+					// zigzag keeps small negative numbers short
+					number((static_cast<std::uint64_t>(i.small()) << 1) ^ static_cast<std::uint64_t>(i.small() >> 63));
+				}
+				else {
+					number(BigInteger);
+					text(i.toString());
+				}
+			},
+			[&](Array &) { throw BadCache(); },
+			[&](Map &) { throw BadCache(); },
+			[&](Channel &) { throw BadCache(); },
+			[&](Segment &) { throw BadCache(); });
+		}
+
+		void block(Ptr<Block> &b)
+		{
+			if (b == nullptr) {
+				number(0);
+				return;
+			}
+			number(b->statements.size() + 1);
+			for (auto &statement : b->statements) {
+				statement->match([&](::Var &v) { var(v); },
+					[&](::If &i) {
+						number(If);
+						expression(i.condition);
+						block(i.body);
+						block(i.elseBody);
+					},
+					[&](::While &w) {
+						number(While);
+						expression(w.condition);
+						block(w.body);
+					},
+					[&](::For &f) {
+						number(For);
+						identifier(f.variable);
+						expression(f.from);
+						expression(f.to);
+						block(f.body);
+						number(f.downto);
+						number(f.parallel);
+					},
+					[&](::Return &r) {
+						number(Return);
+						expression(r.returnValue);
+					},
+					[&](::Call &c) { call(c); },
+					[&](::Operator &o) { oper(o); });
+			}
+			number(scope(b->scope));
+		}
+
+		void var(::Var &v)
+		{
+			number(Var);
+			identifier(v.name);
+			expression(v.value);
+		}
+
+		void func(::Func &f)
+		{
+			number(Func);
+			identifier(f.name);
+			number(f.parameters.size());
+			for (auto &parameter : f.parameters) {
+				identifier(parameter);
+			}
+			block(f.body);
+			number(f.frameSize);
+		}
+	};
+
+	struct Reader
+	{
+		const char *at;
+		const char *end;
+		std::vector<std::string> strings;
+		std::vector<Ptr<Scope>> scopes;
+		std::vector<Value> constants;
+
+		Reader(const char *begin, const char *end) : at(begin), end(end) {}
+
+		std::uint64_t number()
+		{
+			std::uint64_t n = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				if (at == end) {
+					throw BadCache();
+				}
+				std::uint8_t byte = *at++;
+				n |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) {
+					return n;
+				}
+			}
+			throw BadCache();
+		}
+
+		std::size_t count()
+		{
+			auto n = number();
+			// every element takes at least a byte
+			if (n > static_cast<std::uint64_t>(end - at)) {
+				throw BadCache();
+			}
+			return n;
+		}
+
+		std::string text()
+		{
+			auto size = count();
+			std::string result(at, size);
+			at += size;
+			return result;
+		}
+
+		void program(Toplevel &toplevel, StringTable &stringTable)
+		{
+			strings.resize(count());
+			for (auto &s : strings) {
+				s = text();
+			}
+
+			stringTable.stringTable.clear();
+			for (auto n = count(); n > 0; n--) {
+				stringTable.stringTable.insert(stringTable.stringTable.end(), text());
+			}
+			constants.resize(count());
+			for (auto &constant : constants) {
+				constant = ::String(text());
+			}
+			scopes.resize(count());
+			for (std::size_t i = 0; i < scopes.size(); i++) {
+				scopes[i] = std::make_shared<Scope>();
+				auto parent = number();
+				if (parent > i) {
+					throw BadCache();
+				}
+				scopes[i]->parent = scope(parent);
+				for (auto n = count(); n > 0; n--) {
+					auto id = static_cast<int>(number());
+					auto name = identifier();
+					auto offset = number();
+					scopes[i]->add(IdNumber(id), name, offset, number());
+				}
+			}
+
+			toplevel.globals.clear();
+			for (auto n = count(); n > 0; n--) {
+				switch (number()) {
+				case Func:
+					toplevel.globals.push_back(func());
+					break;
+				case Var:
+					toplevel.globals.push_back(var());
+					break;
+				case Call:
+					toplevel.globals.push_back(call());
+					break;
+				default:
+					throw BadCache();
+				}
+			}
+			toplevel.scope = required(scope(number()));
+			toplevel.globalVars = number();
+			toplevel.constants = constants;
+			if (at != end) {
+				throw BadCache();
+			}
+		}
+
+		// a part of the program which can not be left out
+		template <typename T>
+		T required(T part)
+		{
+			if (part == nullptr) {
+				throw BadCache();
+			}
+			return part;
+		}
+
+		Ptr<Scope> scope(std::uint64_t index)
+		{
+			if (index > scopes.size()) {
+				throw BadCache();
+			}
+			return index ? scopes[index - 1] : nullptr;
+		}
+
+		Token token()
+		{
+			auto category = number();
+			auto text = number();
+			auto line = number();
+			if (category > Token::Eof || text >= strings.size()) {
+				throw BadCache();
+			}
+			return Token(static_cast<Token::Category>(category), strings[text], static_cast<int>(line));
+		}
+
+		::Identifier identifier()
+		{
+			::Identifier result;
+			result.token = token();
+			return result;
+		}
+
+		Ptr<Expression> expression()
+		{
+			switch (number()) {
+			case None:
+				return nullptr;
+			case Operator:
+				return make_expr(oper());
+			case Call:
+				return make_expr(call());
+			case Identifier:
+				return make_expr(ExprBase(Atom(identifier())));
+			case SmallInteger: {
+				auto n = number();
+				return make_expr(ExprBase(Atom(Literal(Integer(static_cast<std::int64_t>((n >> 1) ^ (~(n & 1) + 1)))))));
+			}
+			case BigInteger:
+				return make_expr(ExprBase(Atom(Literal(Integer::parse(text())))));
+			case String: {
+				auto index = number();
+				if (index >= constants.size()) {
+					throw BadCache();
+				}
+				return make_expr(ExprBase(Atom(Literal(constants[index]))));
+			}
+			default:
+				throw BadCache();
+			}
+		}
+
+		void operands(OperBase &o)
+		{
+			o.operands.resize(count());
+			for (auto &operand : o.operands) {
+				operand = expression();
+				if (operand == nullptr) {
+					throw BadCache();
+				}
+			}
+		}
+
+		::Operator oper()
+		{
+			::Operator o;
+			o.token = token();
+			o.appends = number();
+			operands(o);
+			return o;
+		}
+
+		::Call call()
+		{
+			::Call c;
+			c.function = identifier();
+			c.isTail = number();
+			c.isSysCall = number();
+			c.isIndependent = number();
+			auto builtin = number();
+			if (builtin > Builtin::CompareSwap) {
+				throw BadCache();
+			}
+			c.builtin = static_cast<Builtin::Kind>(builtin);
+			operands(c);
+			return c;
+		}
+
+		Ptr<Block> block()
+		{
+			auto size = count();
+			if (size == 0) {
+				return nullptr;
+			}
+			auto b = std::make_shared<Block>();
+			for (auto n = size - 1; n > 0; n--) {
+				b->statements.push_back(std::make_shared<Statement>(statement()));
+			}
+			b->scope = required(scope(number()));
+			return b;
+		}
+
+		Statement statement()
+		{
+			switch (number()) {
+			case Var:
+				return var();
+			case If: {
+				::If i;
+				i.condition = required(expression());
+				i.body = required(block());
+				i.elseBody = block();
+				return i;
+			}
+			case While: {
+				::While w;
+				w.condition = required(expression());
+				w.body = required(block());
+				return w;
+			}
+			case For: {
+				::For f;
+				f.variable = identifier();
+				f.from = required(expression());
+				f.to = required(expression());
+				f.body = required(block());
+				f.downto = number();
+				f.parallel = number();
+				return f;
+			}
+			case Return: {
+				::Return r;
+				r.returnValue = required(expression());
+				return r;
+			}
+			case Call:
+				return call();
+			case Operator:
+				return oper();
+			default:
+				throw BadCache();
+			}
+		}
+
+		::Var var()
+		{
+			::Var v;
+			v.name = identifier();
+			v.value = expression();
+			return v;
+		}
+
+		::Func func()
+		{
+			::Func f;
+			f.name = identifier();
+			f.parameters.resize(count());
+			for (auto &parameter : f.parameters) {
+				parameter = identifier();
+			}
+			f.body = required(block());
+			f.frameSize = number();
+			return f;
+		}
+	};
+};
\ No newline at end of file
@@ -2,18 +2,23 @@
 #include <memory>
 #include <brick-types>
 #include <stack>
+#include <stdexcept>
 #include "ast.h"
+#include "memory.h"
+#include "value.h"
 
 using brick::types::Union;
 
-using Value = Union<std::string, int>;
-
 struct CallStack {
 	struct Frame {
 		std::vector<Value> values;
 		bool returned;
+		Charge charge;
 
-		Frame(std::size_t size) : values(size) {}
+		Frame(std::size_t size) : values(size)
+		{
+			charge.set(size * sizeof(Value));
+		}
 
 		Value &operator[](std::size_t idx)
 		{
@@ -28,6 +33,7 @@ struct CallStack {
 		std::size_t size() const { return values.size(); }
 
 		void resize(std::size_t size) {
+			charge.set(size * sizeof(Value));
 			values.resize(size);
 		}
 	};
@@ -77,16 +83,39 @@ struct CallStack {
 
 
 struct Environment {
+	/*
+	 * A call in tail position does not evaluate the callee itself, it only
+	 * leaves it here for the nearest enclosing call to run in the same frame.
+	 */
+	struct TailCall {
+		Func *function = nullptr;
+		std::vector<Value> arguments;
+	};
+
 	StringTable *stringTable;
 	CallStack callStack;
 	std::vector<Value> globals;
+	Charge globalsCharge;
+	TailCall tailCall;
 
 	void start(StringTable *stringTable, std::size_t globalsSize)
 	{
 		this->stringTable = stringTable;
+		globalsCharge.set(globalsSize * sizeof(Value));
 		globals.resize(globalsSize);
 	}
 
+	// a copy for another thread: the globals and the current frame, but not its callers
+	Environment fork() const
+	{
+		Environment result;
+		result.stringTable = stringTable;
+		result.globalsCharge.set(globals.size() * sizeof(Value));
+		result.globals = globals;
+		result.callStack.push(callStack.frames.top());
+		return result;
+	}
+
 	Value &var(Identifier &i, Ptr<Scope> currentScope)
 	{
 		auto symbol = getSymbol(i, currentScope);
@@ -154,96 +183,93 @@ struct Environment {
 	{
 		callStack.setTopReturned(returned);
 	}
-};
 
-Value operator+(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() + rhs.get<int>();
+	bool inFunction() const
+	{
+		return !callStack.frames.empty();
 	}
-	if (lhs.is<std::string>() && rhs.is<std::string>()) {
-		return lhs.get<std::string>() + rhs.get<std::string>();
+
+	std::size_t depth() const
+	{
+		return callStack.frames.size();
 	}
-	if (lhs.is<std::string>() && rhs.is<int>()) {
-		return lhs.get<std::string>() + std::to_string(rhs.get<int>());
+
+	void setTailCall(Func *function, std::vector<Value> &&arguments)
+	{
+		tailCall.function = function;
+		tailCall.arguments = std::move(arguments);
+		setTopReturned(true);
 	}
-	if (lhs.is<int>() && rhs.is<std::string>()) {
-		return std::to_string(lhs.get<int>()) + rhs.get<std::string>();
+
+	bool hasTailCall() const
+	{
+		return tailCall.function != nullptr;
 	}
-	//fail();
-}
 
-Value operator-(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() - rhs.get<int>();
+	TailCall takeTailCall()
+	{
+		TailCall call = std::move(tailCall);
+		tailCall = TailCall();
+		return call;
 	}
-	//fail();
-}
+};
 
-Value operator*(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() * rhs.get<int>();
+inline Value operator+(const Value &lhs, const Value &rhs) {
+	if (lhs.is<Integer>() && rhs.is<Integer>()) {
+		return lhs.get<Integer>() + rhs.get<Integer>();
+	}
+	if (lhs.is<String>() && rhs.is<String>()) {
+		return lhs.get<String>().str() + rhs.get<String>().str();
 	}
-	//fail();
+	if (lhs.is<String>() && rhs.is<Integer>()) {
+		return lhs.get<String>().str() + rhs.get<Integer>().toString();
+	}
+	if (lhs.is<Integer>() && rhs.is<String>()) {
+		return lhs.get<Integer>().toString() + rhs.get<String>().str();
+	}
+	throw std::invalid_argument("operands must be integers or strings");
 }
 
-Value operator/(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() / rhs.get<int>();
+inline Value operator-(const Value &lhs, const Value &rhs) {
+	if (lhs.is<Integer>() && rhs.is<Integer>()) {
+		return lhs.get<Integer>() - rhs.get<Integer>();
 	}
-	//fail();
+	throw std::invalid_argument("operands must be integers");
 }
 
-Value operator%(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() % rhs.get<int>();
+inline Value operator*(const Value &lhs, const Value &rhs) {
+	if (lhs.is<Integer>() && rhs.is<Integer>()) {
+		return lhs.get<Integer>() * rhs.get<Integer>();
 	}
-	//fail();
+	throw std::invalid_argument("operands must be integers");
 }
 
-/*bool operator==(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() == rhs.get<int>();
-	}
-	if (lhs.is<std::string>() && rhs.is<std::string>()) {
-		return lhs.get<std::string>() == rhs.get<std::string>();
-	}
-	if (lhs.is<std::string>() && rhs.is<int>()) {
-		return lhs.get<std::string>().size() == rhs.get<int>();
+inline Value operator/(const Value &lhs, const Value &rhs) {
+	if (lhs.is<Integer>() && rhs.is<Integer>()) {
+		return lhs.get<Integer>() / rhs.get<Integer>();
 	}
-	if (lhs.is<int>() && rhs.is<std::string>()) {
-		return rhs.get<std::string>().size() == lhs.get<int>();
+	throw std::invalid_argument("operands must be integers");
+}
+
+inline Value operator%(const Value &lhs, const Value &rhs) {
+	if (lhs.is<Integer>() && rhs.is<Integer>()) {
+		return lhs.get<Integer>() % rhs.get<Integer>();
 	}
-	//fail();
-}*/
+	throw std::invalid_argument("operands must be integers");
+}
 
-bool operator!=(const Value &lhs, const Value &rhs) {
+inline bool operator!=(const Value &lhs, const Value &rhs) {
 	return !(lhs == rhs);
 }
 
-/*bool operator<(const Value &lhs, const Value &rhs) {
-	if (lhs.is<int>() && rhs.is<int>()) {
-		return lhs.get<int>() < rhs.get<int>();
-	}
-	if (lhs.is<std::string>() && rhs.is<std::string>()) {
-		return lhs.get<std::string>() < rhs.get<std::string>();
-	}
-	if (lhs.is<std::string>() && rhs.is<int>()) {
-		return lhs.get<std::string>().size() < rhs.get<int>();
-	}
-	if (lhs.is<int>() && rhs.is<std::string>()) {
-		return rhs.get<std::string>().size() < lhs.get<int>();
-	}
-	//fail();
-}*/
-
-bool operator>(const Value &lhs, const Value &rhs) {
+inline bool operator>(const Value &lhs, const Value &rhs) {
 	return rhs < lhs;
 }
 
-bool operator<=(const Value &lhs, const Value &rhs) {
+inline bool operator<=(const Value &lhs, const Value &rhs) {
 	return !(rhs < lhs);
 }
 
-bool operator>=(const Value &lhs, const Value &rhs) {
+inline bool operator>=(const Value &lhs, const Value &rhs) {
 	return !(lhs < rhs);
 }
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <ucontext.h>
+#include <brick-mmap>
+
+/*
+ * Cooperatively scheduled coroutines on ucontext. Every coroutine has a
+ * native stack of its own and runs until it finishes or waits: for another
+ * coroutine, for a file descriptor to become ready, for some time to pass or
+ * for a condition to hold.
+ * Coroutine 0 is the one which created the others.
+ *
+ * State is the part of the interpreter which belongs to a coroutine; the
+ * active one is kept in the interpreter and exchanged on every switch.
+ */
+template <typename State>
+struct Coroutines
+{
+	using Clock = std::chrono::steady_clock;
+
+	// pages of the stack are only allocated once they are used
+	static const std::size_t stackSize = 8 << 20;
+
+	struct Coroutine
+	{
+		ucontext_t context;
+		void *stack = nullptr;
+		State state;
+		std::function<void()> body;
+		bool finished = false;
+		std::exception_ptr error;
+
+		// what the coroutine waits for, awaited is 0 if it is not another coroutine
+		std::size_t awaited = 0;
+		int fd = -1;
+		short events = 0;
+		bool sleeping = false;
+		Clock::time_point wakeup;
+		std::function<bool()> condition;
+
+		~Coroutine()
+		{
+			release();
+		}
+
+		void release()
+		{
+			if (stack != nullptr) {
+				brick::mmap::MMap::drop(stack, stackSize);
+				stack = nullptr;
+			}
+		}
+
+		void clearWait()
+		{
+			awaited = 0;
+			fd = -1;
+			sleeping = false;
+			condition = nullptr;
+		}
+	};
+
+	State &active;
+	std::vector<std::unique_ptr<Coroutine>> coroutines;
+	std::size_t current = 0;
+
+	Coroutines(State &active) : active(active)
+	{
+		coroutines.emplace_back(new Coroutine);
+	}
+
+	std::size_t spawn(std::function<void()> body)
+	{
+		std::unique_ptr<Coroutine> coroutine(new Coroutine);
+		coroutine->body = std::move(body);
+		coroutine->stack = brick::mmap::MMap::alloc(stackSize);
+		getcontext(&coroutine->context);
+		coroutine->context.uc_stack.ss_sp = coroutine->stack;
+		coroutine->context.uc_stack.ss_size = stackSize;
+		coroutine->context.uc_link = nullptr;
+
+		// makecontext passes int arguments only
+		auto self = reinterpret_cast<std::uintptr_t>(this);
+		makecontext(&coroutine->context, reinterpret_cast<void (*)()>(&Coroutines::entry), 2,
+		            static_cast<unsigned>(self), static_cast<unsigned>(static_cast<std::uint64_t>(self) >> 32));
+		coroutines.push_back(std::move(coroutine));
+		return coroutines.size() - 1;
+	}
+
+	bool valid(std::size_t handle) const
+	{
+		return handle > 0 && handle < coroutines.size() && handle != current;
+	}
+
+	// whether any other coroutine can still run
+	bool concurrent() const
+	{
+		for (std::size_t i = 0; i < coroutines.size(); i++) {
+			if (i != current && !coroutines[i]->finished) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * Returns once the coroutine has finished, its error is rethrown by the
+	 * first await. False means every coroutine waits for another one.
+	 */
+	bool await(std::size_t handle)
+	{
+		auto &coroutine = *coroutines[handle];
+		if (!coroutine.finished) {
+			coroutines[current]->awaited = handle;
+			// woken up before the end only when nothing else can run
+			if (!schedule() || !coroutine.finished) {
+				return false;
+			}
+		}
+		coroutine.release();
+		if (coroutine.error) {
+			auto error = coroutine.error;
+			coroutine.error = nullptr;
+			std::rethrow_exception(error);
+		}
+		return true;
+	}
+
+	bool wait(int fd, short events)
+	{
+		pollfd request{fd, events, 0};
+		if (!concurrent() || poll(&request, 1, 0) > 0) {
+			return true;
+		}
+		coroutines[current]->fd = fd;
+		coroutines[current]->events = events;
+		return schedule();
+	}
+
+	bool sleep(Clock::duration duration)
+	{
+		if (!concurrent()) {
+			std::this_thread::sleep_for(duration);
+			return true;
+		}
+		coroutines[current]->sleeping = true;
+		coroutines[current]->wakeup = Clock::now() + duration;
+		return schedule();
+	}
+
+	// false means that no other coroutine can run to make the condition hold
+	bool until(std::function<bool()> condition)
+	{
+		if (condition()) {
+			return true;
+		}
+		if (!concurrent()) {
+			return false;
+		}
+		coroutines[current]->condition = std::move(condition);
+		return schedule();
+	}
+
+private:
+	static void entry(unsigned low, unsigned high)
+	{
+		auto self = reinterpret_cast<Coroutines *>(static_cast<std::uintptr_t>(low) |
+		                                           static_cast<std::uint64_t>(high) << 32);
+		auto &coroutine = *self->coroutines[self->current];
+		try {
+			coroutine.body();
+		}
+		catch (...) {
+			coroutine.error = std::current_exception();
+		}
+		coroutine.finished = true;
+		coroutine.body = nullptr;
+		if (!self->schedule()) {
+			// the rest wait for each other, the first coroutine reports it
+			self->switchTo(0);
+		}
+	}
+
+	bool runnable(Coroutine &coroutine, Clock::time_point now)
+	{
+		if (coroutine.finished) {
+			return false;
+		}
+		if (coroutine.awaited != 0) {
+			return coroutines[coroutine.awaited]->finished;
+		}
+		if (coroutine.sleeping) {
+			return now >= coroutine.wakeup;
+		}
+		if (coroutine.condition) {
+			return coroutine.condition();
+		}
+		return coroutine.fd < 0;
+	}
+
+	// switches to the next coroutine which can run, the current one comes last
+	bool schedule()
+	{
+		while (true) {
+			auto now = Clock::now();
+			for (std::size_t step = 1; step <= coroutines.size(); step++) {
+				auto next = (current + step) % coroutines.size();
+				if (runnable(*coroutines[next], now)) {
+					switchTo(next);
+					return true;
+				}
+			}
+
+			std::vector<pollfd> requests;
+			std::vector<std::size_t> waiting;
+			int timeout = -1;
+			for (std::size_t i = 0; i < coroutines.size(); i++) {
+				auto &coroutine = *coroutines[i];
+				if (coroutine.finished || coroutine.awaited != 0) {
+					continue;
+				}
+				if (coroutine.sleeping) {
+					auto left = std::chrono::duration_cast<std::chrono::milliseconds>(coroutine.wakeup - now).count() + 1;
+					left = std::max<decltype(left)>(left, 0);
+					timeout = (timeout < 0) ? left : std::min<int>(timeout, left);
+				}
+				else if (coroutine.fd >= 0) {
+					requests.push_back(pollfd{coroutine.fd, coroutine.events, 0});
+					waiting.push_back(i);
+				}
+			}
+			if (requests.empty() && timeout < 0) {
+				coroutines[current]->clearWait();
+				return false;
+			}
+
+			if (poll(requests.data(), requests.size(), timeout) > 0) {
+				for (std::size_t i = 0; i < requests.size(); i++) {
+					if (requests[i].revents != 0) {
+						coroutines[waiting[i]]->fd = -1;
+					}
+				}
+			}
+		}
+	}
+
+	void switchTo(std::size_t next)
+	{
+		coroutines[next]->clearWait();
+		if (next == current) {
+			return;
+		}
+		auto &from = *coroutines[current];
+		auto &to = *coroutines[next];
+		std::swap(active, from.state);
+		std::swap(active, to.state);
+		current = next;
+		swapcontext(&from.context, &to.context);
+	}
+};
\ No newline at end of file
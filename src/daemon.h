@@ -0,0 +1,349 @@
+#pragma once
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <brick-hash>
+#include "evaluator.h"
+
+struct DaemonError
+{
+	std::string message;
+	DaemonError(std::string m) : message(m) {}
+};
+
+static inline std::ostream &operator<<(std::ostream &out, DaemonError de)
+{
+	out << de.message;
+	return out;
+}
+
+/*
+ * Serves scripts over a Unix socket. A request is either "path <file>\n" or
+ * "source <length>\n" followed by the script itself. Analyzed programs are
+ * cached by the hash of their source; every run happens in a forked child
+ * writing its output to the connection, so runs neither see each other nor
+ * change the cached programs. A run which does not exit with zero is
+ * followed by its exit status or the signal which ended it.
+ *
+ * The connections are taken by a pool of single-threaded worker processes,
+ * each with a cache of its own, so no fork happens in a process with other
+ * threads. Neither a client which is slow to send its request nor a large
+ * script being analyzed holds up more than one worker, and a client which
+ * sends nothing for timeout is left.
+ */
+struct Daemon
+{
+	struct Request
+	{
+		std::string path;
+		std::string source;
+	};
+
+	using Key = brick::hash::hash128_t;
+
+	std::string socketPath;
+	std::size_t capacity = 256;
+	std::size_t workers = 4;
+	std::chrono::seconds timeout{10};
+	std::map<Key, std::shared_ptr<Evaluator>> programs;
+	std::deque<Key> loaded;
+
+	Daemon(std::string socketPath) : socketPath(socketPath) {}
+
+	void serve()
+	{
+		listener = openSocket();
+		for (std::size_t i = 0; i < workers; i++) {
+			startWorker();
+		}
+
+		// a worker which died is replaced
+		while (true) {
+			if (wait(nullptr) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				fail("wait");
+			}
+			startWorker();
+		}
+	}
+
+	void work()
+	{
+		while (true) {
+			int connection = accept(listener, nullptr, nullptr);
+			if (connection < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				fail("accept");
+			}
+			handle(connection);
+			close(connection);
+		}
+	}
+
+	void handle(int connection)
+	{
+		std::shared_ptr<Evaluator> program;
+		try {
+			program = load(receive(connection));
+		}
+		catch (BadParse bp) {
+			return reply(connection, bp);
+		}
+		catch (BadSymbol bs) {
+			return reply(connection, bs);
+		}
+		catch (BadArity ba) {
+			return reply(connection, ba);
+		}
+		catch (DaemonError de) {
+			return reply(connection, de);
+		}
+
+		auto pid = fork();
+		if (pid < 0) {
+			return reply(connection, DaemonError(std::string("fork: ") + strerror(errno)));
+		}
+		if (pid == 0) {
+			close(listener);
+			dup2(connection, STDOUT_FILENO);
+			dup2(connection, STDERR_FILENO);
+			int status = 0;
+			try {
+				program->runAndPrint();
+			}
+			catch (RuntimeError re) {
+				std::cerr << re << std::endl;
+				status = 1;
+			}
+			std::cout.flush();
+			_exit(status);
+		}
+
+		int status;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				return reply(connection, DaemonError(std::string("waitpid: ") + strerror(errno)));
+			}
+		}
+		if (WIFSIGNALED(status)) {
+			reply(connection, DaemonError(std::string("the run was ended by signal ") + strsignal(WTERMSIG(status))));
+		}
+		else if (WEXITSTATUS(status) != 0) {
+			reply(connection, DaemonError("the run exited with status " + std::to_string(WEXITSTATUS(status))));
+		}
+	}
+
+	std::shared_ptr<Evaluator> load(Request request)
+	{
+		if (!request.path.empty()) {
+			std::ifstream in(request.path, std::ios::binary);
+			if (!in) {
+				throw DaemonError("cannot read " + request.path);
+			}
+			std::stringstream s;
+			s << in.rdbuf();
+			request.source = s.str();
+		}
+
+		auto key = brick::hash::spooky(request.source.data(), request.source.size());
+		auto cached = programs.find(key);
+		if (cached != programs.end()) {
+			return cached->second;
+		}
+
+		auto program = std::make_shared<Evaluator>(Source{request.source});
+		program->load();
+		if (loaded.size() == capacity) {
+			programs.erase(loaded.front());
+			loaded.pop_front();
+		}
+		loaded.push_back(key);
+		return programs[key] = program;
+	}
+
+	// sends a request to a running daemon and copies the output of the run to out
+	static void send(const std::string &socketPath, const std::string &request, std::ostream &out)
+	{
+		int connection = connectSocket(socketPath);
+		writeAll(connection, request);
+		shutdown(connection, SHUT_WR);
+
+		char buffer[4096];
+		ssize_t count;
+		while ((count = read(connection, buffer, sizeof(buffer))) > 0) {
+			out.write(buffer, count);
+		}
+		close(connection);
+	}
+
+	static std::string pathRequest(const std::string &file)
+	{
+		char *absolute = realpath(file.c_str(), nullptr);
+		std::string path = absolute ? absolute : file;
+		free(absolute);
+		return "path " + path + "\n";
+	}
+
+	static std::string sourceRequest(const std::string &source)
+	{
+		return "source " + std::to_string(source.size()) + "\n" + source;
+	}
+
+private:
+	int listener = -1;
+
+	// forked while the daemon has no other thread, a worker ends with it
+	void startWorker()
+	{
+		auto daemon = getpid();
+		auto pid = fork();
+		if (pid < 0) {
+			fail("fork");
+		}
+		if (pid == 0) {
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			if (getppid() == daemon) {
+				try {
+					work();
+				}
+				catch (DaemonError de) {
+					std::cerr << de << std::endl;
+				}
+			}
+			_exit(1);
+		}
+	}
+
+	static void fail(std::string what)
+	{
+		throw DaemonError(what + ": " + strerror(errno));
+	}
+
+	static sockaddr_un address(const std::string &path)
+	{
+		sockaddr_un result = {};
+		result.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(result.sun_path)) {
+			throw DaemonError("socket path too long: " + path);
+		}
+		strcpy(result.sun_path, path.c_str());
+		return result;
+	}
+
+	int openSocket()
+	{
+		auto addr = address(socketPath);
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0) {
+			fail("socket");
+		}
+		unlink(socketPath.c_str());
+		if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+			fail("bind");
+		}
+		if (listen(listener, 64) < 0) {
+			fail("listen");
+		}
+		return listener;
+	}
+
+	static int connectSocket(const std::string &path)
+	{
+		auto addr = address(path);
+		int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connection < 0) {
+			fail("socket");
+		}
+		if (connect(connection, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+			close(connection);
+			fail("connect");
+		}
+		return connection;
+	}
+
+	static void writeAll(int fd, const std::string &data)
+	{
+		std::size_t written = 0;
+		while (written < data.size()) {
+			auto count = write(fd, data.data() + written, data.size() - written);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				fail("write");
+			}
+			written += count;
+		}
+	}
+
+	Request receive(int connection)
+	{
+		timeval limit{static_cast<time_t>(timeout.count()), 0};
+		if (setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit)) < 0) {
+			fail("setsockopt");
+		}
+
+		std::string header;
+		char c;
+		ssize_t count;
+		while ((count = read(connection, &c, 1)) == 1 && c != '\n') {
+			header += c;
+		}
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			throw DaemonError("no request within " + std::to_string(timeout.count()) + " seconds");
+		}
+
+		Request request;
+		if (header.compare(0, 5, "path ") == 0) {
+			request.path = header.substr(5);
+			return request;
+		}
+		if (header.compare(0, 7, "source ") == 0) {
+			auto length = std::strtoull(header.c_str() + 7, nullptr, 10);
+			request.source.resize(length);
+			std::size_t received = 0;
+			while (received < length) {
+				auto count = read(connection, &request.source[received], length - received);
+				if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					throw DaemonError("the source stopped for " + std::to_string(timeout.count()) + " seconds");
+				}
+				if (count <= 0) {
+					throw DaemonError("incomplete source");
+				}
+				received += count;
+			}
+			return request;
+		}
+		throw DaemonError("bad request: " + header);
+	}
+
+	template <typename T>
+	void reply(int connection, T error)
+	{
+		std::stringstream s;
+		s << error << std::endl;
+		try {
+			writeAll(connection, s.str());
+		}
+		catch (DaemonError) {}
+	}
+};
\ No newline at end of file
@@ -3,14 +3,31 @@
 #include <functional>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <stack>
 #include <string>
+#include <thread>
+#include <cerrno>
+#include <cstring>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "analyzer.h"
+#include "budget.h"
+#include "cache.h"
+#include "scheduler.h"
 #include "ast.h"
 #include "call_stack.h"
+#include "coroutines.h"
+#include "forkmap.h"
 
 
 struct RuntimeError
@@ -25,6 +42,63 @@ static inline std::ostream &operator<<(std::ostream &out, RuntimeError re)
 	return out;
 }
 
+/*
+ * The threads of a run which work on iterations of pfor. A thread which
+ * waits for a channel registers its condition; once every thread waits and
+ * none of the conditions holds, no thread is left to change a channel and
+ * all the waiting ones fail.
+ */
+struct Waits
+{
+	using Condition = std::function<bool()>;
+
+	std::mutex lock;
+	std::size_t threads = 1;
+	std::vector<const Condition *> waiting;
+	bool deadlocked = false;
+
+	void add(std::size_t count)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		threads += count;
+	}
+
+	void remove()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		--threads;
+	}
+
+	// registered for as long as the thread waits
+	struct Entry
+	{
+		Waits &waits;
+		const Condition *condition;
+
+		Entry(Waits &waits, const Condition &condition) : waits(waits), condition(&condition)
+		{
+			std::lock_guard<std::mutex> guard(waits.lock);
+			waits.waiting.push_back(this->condition);
+		}
+
+		~Entry()
+		{
+			std::lock_guard<std::mutex> guard(waits.lock);
+			waits.waiting.erase(std::find(waits.waiting.begin(), waits.waiting.end(), condition));
+		}
+	};
+
+	// with every thread waiting, none of them can change what the others wait for
+	bool deadlock()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!deadlocked && waiting.size() >= threads) {
+			deadlocked = std::none_of(waiting.begin(), waiting.end(), [](const Condition *c) { return (*c)(); });
+		}
+		return deadlocked;
+	}
+};
+
 struct Evaluator {
 	using no_args_func_ptr = int (*)();
 	using one_args_func_ptr = int (*)(int);
@@ -33,35 +107,169 @@ struct Evaluator {
 	using four_args_func_ptr = int (*)(int, int, int, int);
 
 
-	Analyzer analyzer;
+	// shared by the copies evaluating independent calls in parallel
+	std::shared_ptr<Analyzer> analyzer;
 	Toplevel toplevel;
 	Environment environment;
-
-	Evaluator(const char *file) : analyzer(file) {}
+	std::string file;
+	bool cache = false;
+	bool parallel = false;
+	// other threads run the same pfor, they may use the channels of this one
+	bool threaded = false;
+	Limits limits;
+	// of the current run, shared with the copies evaluating in parallel
+	std::shared_ptr<Budget> budget;
+	// executed, but not added to the budget yet
+	std::uint64_t statements = 0;
+	std::uint32_t checks = 0;
+	// counts memory even without a limit, for its peak
+	bool measureMemory = false;
+	std::shared_ptr<Memory> memory;
+	// of the current run, shared with the workers of pfor
+	std::shared_ptr<Waits> waits;
+	// created by the first Spawn, coroutine 0 is the program itself
+	std::unique_ptr<Coroutines<CallStack>> coroutines;
+	std::vector<Value> coroutineResults;
+
+	Evaluator(const char *file) : analyzer(std::make_shared<Analyzer>(file)), file(file) {}
 
 	Evaluator(std::string file) : Evaluator(file.c_str()) {}
 
+	// a program without a file is never cached
+	Evaluator(Source source) : analyzer(std::make_shared<Analyzer>(std::move(source))) {}
+
+	// evaluates the same program in another environment
+	Evaluator(const Evaluator &other, Environment environment)
+		: analyzer(other.analyzer), toplevel(other.toplevel), environment(std::move(environment)), file(other.file),
+		  cache(other.cache), parallel(other.parallel), threaded(other.threaded), limits(other.limits),
+		  budget(other.budget), measureMemory(other.measureMemory), memory(other.memory), waits(other.waits)
+	{}
+
 	void evalAndPrint()
 	{
-		for (auto r : eval()) {
+		load();
+		runAndPrint();
+	}
+
+	void runAndPrint()
+	{
+		for (auto r : run()) {
 			print(r);
 		}
 	}
 
 	std::vector<Value> eval()
 	{
-		std::vector<Value> results;
-		toplevel = analyzer.toplevel();
-		environment.start(&analyzer.parser.stringTable, toplevel.globalVars);
-		for (auto &global : toplevel.globals) {
-			global.match([&](Call c) {
-				results.push_back(eval(*make_expr(c), toplevel.scope));
-			},
-			[&](Var v) {
-				eval(v, toplevel.scope);
-			});
+		load();
+		return run();
+	}
+
+	// parses and analyzes the program, which can then be run any number of times
+	void load()
+	{
+		if (parallel) {
+			analyzer->parser.workers = std::max(1u, std::thread::hardware_concurrency());
 		}
-		return results;
+		if (!cache || file.empty()) {
+			toplevel = analyzer->toplevel();
+		}
+		else {
+			ProgramCache programCache(file, analyzer->optimize);
+			if (!programCache.load(toplevel, analyzer->parser.stringTable)) {
+				toplevel = analyzer->toplevel();
+				programCache.store(toplevel, analyzer->parser.stringTable);
+			}
+		}
+		analyzer->parser.lexer.release();
+	}
+
+	std::vector<Value> run()
+	{
+		budget = limits.budgeted() ? std::make_shared<Budget>(limits) : nullptr;
+		memory = (limits.memory != 0 || measureMemory) ? std::make_shared<Memory>(limits.memory) : nullptr;
+		waits = std::make_shared<Waits>();
+		Memory::Scope scope(memory);
+		try {
+			std::vector<Value> results;
+			std::vector<Call> independent;
+			start();
+			for (auto &global : toplevel.globals) {
+				if (parallel && global.is<Call>() && global.get<Call>().isIndependent) {
+					independent.push_back(global.get<Call>());
+					continue;
+				}
+				parallelCalls(independent, results);
+				global.match([&](Call c) {
+					results.push_back(eval(*make_expr(c), toplevel.scope));
+				},
+				[&](Var v) {
+					eval(v, toplevel.scope);
+				});
+			}
+			parallelCalls(independent, results);
+			finishCoroutines();
+			return results;
+		}
+		catch (MemoryExceeded &e) {
+			throw RuntimeError("the run needed more than " + std::to_string(e.limit) + " bytes of memory");
+		}
+	}
+
+	void start()
+	{
+		coroutines.reset();
+		coroutineResults.clear();
+		environment = Environment();
+		environment.start(&analyzer->parser.stringTable, toplevel.globalVars);
+	}
+
+	/*
+	 * Independent calls touch no globals and call no system functions, so
+	 * they can run at once, each on a copy of the evaluator with a call stack
+	 * of its own. Their values and errors are reported in program order.
+	 */
+	void parallelCalls(std::vector<Call> &calls, std::vector<Value> &results)
+	{
+		std::vector<Value> values(calls.size());
+		std::vector<std::exception_ptr> errors(calls.size());
+		std::atomic<std::size_t> next(0);
+
+		auto worker = [&] {
+			Memory::Scope scope(memory);
+			Evaluator evaluator(*this, Environment());
+			// independent calls share no channel, the threads of one do not wait for another
+			evaluator.waits = std::make_shared<Waits>();
+			evaluator.start();
+			for (std::size_t i = next++; i < calls.size(); i = next++) {
+				try {
+					values[i] = evaluator.eval(*make_expr(calls[i]), toplevel.scope);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		auto count = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), calls.size());
+		for (std::size_t i = 1; i < count; i++) {
+			threads.emplace_back(worker);
+		}
+		if (count > 0) {
+			worker();
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+
+		for (std::size_t i = 0; i < calls.size(); i++) {
+			if (errors[i]) {
+				calls.clear();
+				std::rethrow_exception(errors[i]);
+			}
+			results.push_back(values[i]);
+		}
+		calls.clear();
 	}
 
 	void eval(If &i, Ptr<Scope> currentScope)
@@ -80,31 +288,89 @@ struct Evaluator {
 			if (environment.isTopReturned()) {
 				break;
 			}
+			checkBudget();
 		}
 	}
 
 	void eval(For &f, Ptr<Scope> currentScope)
 	{
-		auto from = eval(*f.from, currentScope);
-		//TODO check if "from" is int
+		if (f.parallel) {
+			parallelFor(f, currentScope);
+			return;
+		}
 
-		auto to = eval(*f.to, currentScope);
-		//TODO check if "to" is int
+		auto first = bound(f, eval(*f.from, currentScope), "from");
+		auto last = bound(f, eval(*f.to, currentScope), "to");
 
-		int i;
+		std::int64_t i;
 		auto symbol = environment.getSymbol(f.variable, f.body->scope);
 		std::vector<std::function<void()>> functors{[&] { i++; }, [&] { i--; }};
-		std::vector<std::function<bool()>> comps{[&] { return i <= to.get<int>(); }, [&] { return i >= to.get<int>(); }};
+		std::vector<std::function<bool()>> comps{[&] { return i <= last; }, [&] { return i >= last; }};
 
-		for (i = from.get<int>(); comps[static_cast<int>(f.downto)]() ; functors[static_cast<int>(f.downto)]()) {
-			environment[symbol.offset] = i;
+		for (i = first; comps[static_cast<int>(f.downto)]() ; functors[static_cast<int>(f.downto)]()) {
+			environment[symbol.offset] = Integer(i);
 			eval(*f.body, f.body->scope);
 			if (environment.isTopReturned()) {
 				break;
 			}
+			checkBudget();
 		}
 	}
 
+	/*
+	 * Every worker of pfor runs its iterations on a copy of the evaluator with
+	 * a copy of the globals and of the current frame, so assignments to
+	 * variables stay within the worker. Results are passed out through arrays
+	 * and maps, which all workers share and whose builtins lock them, or
+	 * through channels.
+	 */
+	void parallelFor(For &f, Ptr<Scope> currentScope)
+	{
+		auto from = bound(f, eval(*f.from, currentScope), "from");
+		auto to = bound(f, eval(*f.to, currentScope), "to");
+		auto count = (f.downto ? from - to : to - from) + 1;
+		if (count <= 0) {
+			return;
+		}
+
+		auto symbol = environment.getSymbol(f.variable, f.body->scope);
+		auto workers = std::min<std::int64_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+		std::vector<std::unique_ptr<Evaluator>> evaluators;
+		for (std::int64_t i = 0; i < workers; i++) {
+			evaluators.emplace_back(new Evaluator(*this, environment.fork()));
+			evaluators.back()->threaded = threaded || workers > 1;
+		}
+
+		// this thread goes on once all workers are done
+		struct Threads
+		{
+			Waits &waits;
+
+			Threads(Waits &waits, std::size_t workers) : waits(waits)
+			{
+				waits.add(workers - 1);
+			}
+
+			~Threads()
+			{
+				waits.add(1);
+			}
+		} threads(*waits, workers);
+
+		Scheduler(workers).run(count, [&](std::size_t worker, std::int64_t iteration) {
+			Memory::Scope scope(memory);
+			auto &evaluator = *evaluators[worker];
+			evaluator.environment[symbol.offset] = Integer(f.downto ? from - iteration : from + iteration);
+			evaluator.eval(*f.body, f.body->scope);
+			if (evaluator.environment.isTopReturned()) {
+				fail(f.variable.token, ": return is not allowed inside pfor");
+			}
+			evaluator.checkBudget();
+		}, [&] {
+			waits->remove();
+		});
+	}
+
 	Value eval(Expression &ex, Ptr<Scope> currentScope)
 	{
 		Expression toEval = ex;
@@ -120,7 +386,17 @@ struct Evaluator {
 				}
 
 				--opers.top().second;
-				if (opers.top().second == 0) {
+				if (shortCircuits(opers.top().first, values.top())) {
+					auto evaluated = getOperandCount(opers.top().first) - opers.top().second;
+					for (std::size_t i = 0; i < evaluated; i++) {
+						values.pop();
+					}
+
+					auto category = opers.top().first.get<Operator>().token.category;
+					toEval = Expression(ExprBase(Atom(Literal(category == Token::Or ? 1 : 0))));
+
+					opers.pop();
+				} else if (opers.top().second == 0) {
 					auto count = getOperandCount(opers.top().first);
 					std::vector<Atom> operands(count);
 
@@ -163,6 +439,25 @@ struct Evaluator {
 		}
 	}
 
+	/*
+	 * && and || stop at the first operand which decides the result, the rest
+	 * of the operands is never evaluated.
+	 */
+	bool shortCircuits(Expression &ex, Atom &value)
+	{
+		if (!ex.is<Operator>() || !value.is<Literal>()) {
+			return false;
+		}
+		switch (ex.get<Operator>().token.category) {
+			case Token::And:
+				return value.get<Literal>() == Value(0);
+			case Token::Or:
+				return value.get<Literal>() != Value(0);
+			default:
+				return false;
+		}
+	}
+
 	bool needToEval(Expression &op, Expression &func, int opOrder) {
 		return (op.is<Atom>() && !(func.is<Call>() && func.get<Call>().function.token.text == "Read" && opOrder == 1) &&
 			!(func.is<Operator>() && func.get<Operator>().token.category == Token::Assign && opOrder == 1));
@@ -171,9 +466,8 @@ struct Evaluator {
 	Value eval(Expression &ex, std::vector<Atom> &&operands, Ptr<Scope> currentScope) {
 		if (ex.is<Operator>()) {
 			return eval(ex.get<Operator>().token, operands, currentScope);
-		} else if (ex.is<Call>()) {
-			return eval(ex.get<Call>(), operands, currentScope);
 		}
+		return eval(ex.get<Call>(), operands, currentScope);
 	}
 
 	Value eval(Token oper, std::vector<Atom> &operands, Ptr<Scope> currentScope)
@@ -200,7 +494,10 @@ struct Evaluator {
 
 	Value eval(Call &call, std::vector<Atom> &operands, Ptr<Scope> currentScope)
 	{
-		if (call.isSysCall) {
+		if (call.builtin != Builtin::None) {
+			return builtinCall(call, operands, currentScope);
+		}
+		else if (call.isSysCall) {
 			return systemCall(call, operands, currentScope);
 		}
 		else {
@@ -222,7 +519,7 @@ struct Evaluator {
 		if (v.value != nullptr) {
 			environment.var(v.name, currentScope) = eval(*v.value, currentScope);
 		} else {
-			environment.var(v.name, currentScope) = 0;
+			environment.var(v.name, currentScope) = Value(0);
 		}
 	}
 
@@ -236,35 +533,87 @@ struct Evaluator {
 	void eval(Block &b, Ptr<Scope> currentScope)
 	{
 		for (auto statement : b.statements) {
+			++statements;
 			statement->match([&](Var &v) { eval(v, currentScope); },
 			                 [&](If &i) { eval(i, currentScope); },
 			                 [&](While &w) { eval(w, currentScope); },
 			                 [&](For &f) { eval(f, currentScope); },
 			                 [&](Return &r) { eval(r, currentScope); },
 			                 [&](Call &c) { eval(*make_expr(c), currentScope); },
-			                 [&](Operator &o) { eval(*make_expr(o), currentScope); });
+			                 [&](Operator &o) {
+			                     if (o.appends) {
+			                         append(o, currentScope);
+			                     } else {
+			                         eval(*make_expr(o), currentScope);
+			                     }
+			                 });
 			if (environment.isTopReturned()) {
 				break;
 			}
 		}
 	}
 
+	/*
+	 * Appending in place reuses the capacity of the string held by the
+	 * variable, so a loop building a string is linear instead of quadratic.
+	 */
+	void append(Operator &o, Ptr<Scope> currentScope)
+	{
+		auto &target = o.operands[0]->get<Atom>().get<Identifier>();
+		if (!environment.var(target, currentScope).is<String>()) {
+			eval(*make_expr(o), currentScope);
+			return;
+		}
+
+		auto &operands = o.operands[1]->get<Operator>().operands;
+		std::vector<Value> values;
+		for (auto it = operands.begin() + 1; it != operands.end(); ++it) {
+			values.push_back(eval(**it, currentScope));
+		}
+
+		auto &string = environment.var(target, currentScope).get<String>();
+		auto &str = string.mutate();
+		for (auto &value : values) {
+			concatenate(str, value);
+		}
+		string.settle();
+	}
+
 private:
 	template <typename T>
-	void fail(T t, std::string msg)
+	[[noreturn]] void fail(T t, std::string msg)
 	{
 		std::stringstream s;
 		s << t;
 		throw RuntimeError(s.str() + msg);
 	}
 
+	// the loop variable holds a small integer only
+	std::int64_t bound(For &f, const Value &value, const char *which)
+	{
+		if (!value.is<Integer>() || !value.get<Integer>().isSmall()) {
+			fail(f.variable.token, std::string(": the bound after ") + which + " has to be a 64-bit integer");
+		}
+		return value.get<Integer>().small();
+	}
+
 	bool convert(Value val)
 	{
-		if (val.is<int>()) {
-			return val.get<int>() != 0;
-		} else if (val.is<std::string>()) {
-			return !val.get<std::string>().empty();
+		if (val.is<Array>()) {
+			auto guard = shared(val.get<Array>().lock());
+			return !val.get<Array>().elements().empty();
+		} else if (val.is<Map>()) {
+			auto guard = shared(val.get<Map>().lock());
+			return val.get<Map>().size() != 0;
+		} else if (val.is<Segment>()) {
+			return val.get<Segment>().size() != 0;
+		} else if (val.is<Channel>()) {
+			// whether anything can still be received
+			return !val.get<Channel>().closed() || !val.get<Channel>().empty();
+		} else if (val.is<Integer>()) {
+			return !val.get<Integer>().isZero();
 		}
+		return !val.get<String>().empty();
 	}
 
 	void print(Value val)
@@ -277,29 +626,44 @@ private:
 		std::cout << environment.var(i, currentScope) << std::endl;
 	}
 
-	Func getFunction(Identifier &i)
+	Func &getFunction(Identifier &i)
+	{
+		auto func = findFunction(i.token.text);
+		if (func == nullptr) {
+			fail(i.token, " is not a function");
+		}
+		return *func;
+	}
+
+	Func *findFunction(const std::string &name)
 	{
 		for (auto &global : toplevel.globals) {
-			if (global.is<Func>() && global.get<Func>().name.token.text == i.token.text) {
-				return global.get<Func>();
+			if (global.is<Func>() && global.get<Func>().name.token.text == name) {
+				return &global.get<Func>();
 			}
 		}
+		return nullptr;
 	}
 
 	Value operators(Token oper, std::vector<Value> &operands)
 	{
 		switch (oper.category) {
 			case Token::Plus:
-				if (operands.front().is<int>()) {
+				checkOperands(oper, operands);
+				if (operands.front().is<Integer>()) {
 					return std::accumulate(operands.begin(), operands.end(), Value(0),
 					                       [](Value &lhs, Value &rhs) { return lhs + rhs; });
 				}
 				else {
-					return std::accumulate(operands.begin(), operands.end(), Value(""),
-					                       [](Value &lhs, Value &rhs) { return lhs + rhs; });
+					std::string result;
+					for (auto &operand : operands) {
+						concatenate(result, operand);
+					}
+					return result;
 				}
 
 			case Token::Minus:
+				checkOperands(oper, operands);
 				if (operands.size() == 1) {
 					return 0 - operands.front();
 				}
@@ -309,10 +673,13 @@ private:
 				}
 
 			case Token::Times:
+				checkOperands(oper, operands);
 				return std::accumulate(operands.begin(), operands.end(), Value(1),
 				                       [](Value &lhs, Value &rhs) { return lhs * rhs; });
 
 			case Token::Slash:
+				checkOperands(oper, operands);
+				checkDivisors(oper, operands);
 				if (operands.size() == 1) {
 					return operands.front();
 				}
@@ -322,6 +689,8 @@ private:
 				}
 
 			case Token::Modulo:
+				checkOperands(oper, operands);
+				checkDivisors(oper, operands);
 				if (operands.size() == 1) {
 					return operands.front();
 				}
@@ -365,15 +734,58 @@ private:
 				return checkOrder(operands, [](Value &lhs, Value &rhs) { return lhs >= rhs; });
 
 			default:
-				break;
+				fail(oper, " is not an operator");
+		}
+	}
+
+	void concatenate(std::string &str, const Value &value)
+	{
+		if (value.is<String>()) {
+			str += value.get<String>().str();
+		} else if (value.is<Integer>()) {
+			str += value.get<Integer>().toString();
+		} else {
+			std::stringstream s;
+			s << value;
+			str += s.str();
+		}
+	}
+
+	// strings are joined by +, anything else takes integers only
+	void checkOperands(Token oper, std::vector<Value> &operands)
+	{
+		if (oper.category == Token::Plus) {
+			if (operands.front().is<String>()) {
+				return;
+			}
+			for (auto &operand : operands) {
+				if (!operand.is<Integer>() && !operand.is<String>()) {
+					fail(oper, ": operands must be integers or strings");
+				}
+			}
+			return;
+		}
+		for (auto &operand : operands) {
+			if (!operand.is<Integer>()) {
+				fail(oper, ": operands must be integers");
+			}
+		}
+	}
+
+	void checkDivisors(Token oper, std::vector<Value> &operands)
+	{
+		for (std::size_t i = 1; i < operands.size(); i++) {
+			if (operands[i] == Value(0)) {
+				fail(oper, " division by zero");
+			}
 		}
 	}
 
 	template< typename Compare >
 	bool checkOrder(std::vector<Value> &operands, Compare comp)
 	{
-		for (int i = 0; i < operands.size() - 1; i++) {
-			if (!comp(operands[i], operands[i+1])) {
+		for (std::size_t i = 1; i < operands.size(); i++) {
+			if (!comp(operands[i-1], operands[i])) {
 				return false;
 			}
 		}
@@ -385,11 +797,9 @@ private:
 		if (ex.is<Operator>()) {
 			auto &op = ex.get<Operator>();
 			return op.operands.size();
-
-		} else if (ex.is<Call>()) {
-			auto &call = ex.get<Call>();
-			return call.operands.size();
 		}
+		auto &call = ex.get<Call>();
+		return call.operands.size();
 	}
 
 	Expression getNextOperand(std::pair<Expression, int> &oper)
@@ -401,12 +811,10 @@ private:
 			auto &op = ex.get<Operator>();
 			auto i = op.operands.size() - idx;
 			return *op.operands[i];
-
-		} else if (ex.is<Call>()) {
-			auto &call = ex.get<Call>();
-			auto i = call.operands.size() - idx;
-			return *call.operands[i];
 		}
+		auto &call = ex.get<Call>();
+		auto i = call.operands.size() - idx;
+		return *call.operands[i];
 	}
 
 	Value systemCall(Call &call, std::vector<Atom> &arguments, Ptr<Scope> currentScope)
@@ -428,38 +836,507 @@ private:
 		}
 	}
 
+	/*
+	 * Tail calls are trampolined: the callee is handed back to the call which
+	 * owns the current frame and runs in a loop there, so tail recursion
+	 * needs neither native stack nor new frames.
+	 */
 	Value functionCall(Call &call, std::vector<Atom> &operands, Ptr<Scope> currentScope)
 	{
-		auto func = getFunction(call.function);
+		auto *func = &getFunction(call.function);
 
-		if (func.parameters.size() != operands.size()) {
+		if (func->parameters.size() != operands.size()) {
 			this->fail(call.function.token,
 			           ": the number of given arguments is different than number of required arguments");
 		}
 
-		if (call.isTail) {
-			environment.resizeTopFrame(func.frameSize);
-		} else {
-			environment.pushFrame(func.frameSize);
+		std::vector<Value> arguments;
+		for (auto &operand : operands) {
+			arguments.push_back(eval(operand, currentScope));
 		}
 
-		for (int i = 0; i < operands.size(); i++) {
-			environment[i] = eval(operands[i], currentScope);
+		if (call.isTail && environment.inFunction()) {
+			environment.setTailCall(func, std::move(arguments));
+			return 0;
 		}
+		if (budget != nullptr && limits.depth != 0 && environment.depth() >= limits.depth) {
+			fail(call.function.token, ": calls are nested deeper than " + std::to_string(limits.depth));
+		}
+		return invoke(func, std::move(arguments));
+	}
+
+	Value invoke(Func *func, std::vector<Value> arguments)
+	{
+		environment.pushFrame(func->frameSize);
+		while (true) {
+			for (std::size_t i = 0; i < arguments.size(); i++) {
+				environment[i] = std::move(arguments[i]);
+			}
+
+			environment.setTopReturned(false);
+			environment[environment.topFrameSize() - 1] = Value(0);
 
-		environment.setTopReturned(false);
-		environment[environment.topFrameSize() - 1] = 0;
+			checkBudget();
+			eval(*func->body, func->body->scope);
 
-		eval(*func.body, func.body->scope);
+			if (!environment.hasTailCall()) {
+				break;
+			}
+			auto next = environment.takeTailCall();
+			func = next.function;
+			arguments = std::move(next.arguments);
+			environment.resizeTopFrame(func->frameSize);
+		}
 
 		auto value = environment[environment.topFrameSize() - 1];
+		environment.popFrame();
+		return value;
+	}
+
+	Value builtinCall(Call &call, std::vector<Atom> &arguments, Ptr<Scope> currentScope)
+	{
+		std::vector<Value> values;
+		for (auto &argument : arguments) {
+			values.push_back(eval(argument, currentScope));
+		}
+
+		switch (call.builtin) {
+			case Builtin::Array:
+				if (!values[0].is<Integer>() || !values[0].get<Integer>().fits(0, INT_MAX)) {
+					fail(call.function.token, " requires 1. operand to be a non-negative integer");
+				}
+				return Array(values[0].get<Integer>().small());
+
+			case Builtin::Get: {
+				if (values[0].is<Segment>()) {
+					auto &segment = values[0].get<Segment>();
+					return Integer(segment.cell(index(call, values[1], segment.size())).load());
+				}
+				auto guard = shared(array(call, values[0]).lock());
+				auto &elements = array(call, values[0]).elements();
+				return elements[index(call, values[1], elements.size())];
+			}
+
+			case Builtin::Set: {
+				if (values[0].is<Segment>()) {
+					auto &segment = values[0].get<Segment>();
+					segment.cell(index(call, values[1], segment.size())).store(cell(call, values[2], 3));
+					return values[2];
+				}
+				auto guard = shared(array(call, values[0]).lock());
+				auto &elements = array(call, values[0]).elements();
+				elements[index(call, values[1], elements.size())] = values[2];
+				return values[2];
+			}
+
+			case Builtin::Len: {
+				if (values[0].is<String>()) {
+					return values[0].get<String>().size();
+				}
+				if (values[0].is<Map>()) {
+					auto guard = shared(values[0].get<Map>().lock());
+					return values[0].get<Map>().size();
+				}
+				if (values[0].is<Channel>()) {
+					return values[0].get<Channel>().size();
+				}
+				if (values[0].is<Segment>()) {
+					return values[0].get<Segment>().size();
+				}
+				auto guard = shared(array(call, values[0]).lock());
+				return array(call, values[0]).elements().size();
+			}
+
+			case Builtin::Push: {
+				auto guard = shared(array(call, values[0]).lock());
+				auto &elements = array(call, values[0]).elements();
+				elements.push_back(values[1]);
+				array(call, values[0]).settle();
+				return elements.size();
+			}
+
+			case Builtin::Map:
+				return Map();
+
+			case Builtin::Put: {
+				auto guard = shared(map(call, values[0]).lock());
+				map(call, values[0]).put(key(call, values[1]), values[2]);
+				return values[2];
+			}
 
-		if (!call.isTail) {
-			environment.popFrame();
+			case Builtin::Lookup: {
+				auto guard = shared(map(call, values[0]).lock());
+				auto value = map(call, values[0]).find(key(call, values[1]));
+				if (value == nullptr) {
+					std::string text;
+					concatenate(text, values[1]);
+					fail(call.function.token, ": key " + text + " is not in the map");
+				}
+				return *value;
+			}
+
+			case Builtin::Has: {
+				auto guard = shared(map(call, values[0]).lock());
+				return map(call, values[0]).find(key(call, values[1])) != nullptr;
+			}
+
+			case Builtin::Delete: {
+				auto guard = shared(map(call, values[0]).lock());
+				return map(call, values[0]).remove(key(call, values[1]));
+			}
+
+			case Builtin::Keys: {
+				auto guard = shared(map(call, values[0]).lock());
+				Array keys;
+				keys.elements() = map(call, values[0]).keys();
+				keys.settle();
+				return keys;
+			}
+
+			case Builtin::Spawn:
+				return spawn(call, values);
+
+			case Builtin::ForkMap:
+				return forkMap(call, values);
+
+			case Builtin::Await: {
+				if (coroutines == nullptr || !values[0].is<Integer>() || !values[0].get<Integer>().isSmall() ||
+				    values[0].get<Integer>().small() < 0 || !coroutines->valid(values[0].get<Integer>().small())) {
+					fail(call.function.token, " requires 1. operand to be a coroutine");
+				}
+				auto handle = values[0].get<Integer>().small();
+				if (!coroutines->await(handle)) {
+					fail(call.function.token, ": all coroutines are waiting for each other");
+				}
+				return coroutineResults[handle];
+			}
+
+			case Builtin::Chan:
+				if (!values[0].is<Integer>() || !values[0].get<Integer>().fits(1, INT_MAX)) {
+					fail(call.function.token, " requires 1. operand to be a positive integer");
+				}
+				return Channel(values[0].get<Integer>().small());
+
+			case Builtin::ChanSend: {
+				auto &target = channel(call, values[0]);
+				while (!target.send(values[1])) {
+					if (target.closed()) {
+						fail(call.function.token, ": the channel is closed");
+					}
+					ready(call, [&] { return target.closed() || !target.full(); });
+				}
+				return values[1];
+			}
+
+			case Builtin::ChanRecv: {
+				auto &source = channel(call, values[0]);
+				Value value;
+				while (true) {
+					// when it was closed before the attempt, nothing can be sent after it
+					bool closed = source.closed();
+					if (source.receive(value)) {
+						return value;
+					}
+					if (closed) {
+						fail(call.function.token, ": the channel is closed");
+					}
+					ready(call, [&] { return source.closed() || !source.empty(); });
+				}
+			}
+
+			case Builtin::ChanClose:
+				channel(call, values[0]).close();
+				return 0;
+
+			case Builtin::Segment:
+				return openSegment(call, values);
+
+			case Builtin::DropSegment:
+				return shm_unlink(segmentName(call, values[0]).c_str()) == 0;
+
+			case Builtin::AtomicAdd: {
+				auto &target = segment(call, values[0]).cell(index(call, values[1], segment(call, values[0]).size()));
+				auto delta = cell(call, values[2], 3);
+				auto old = target.load();
+				std::int64_t result;
+				do {
+					if (__builtin_add_overflow(old, delta, &result)) {
+						fail(call.function.token, ": the cell would overflow");
+					}
+				} while (!target.compare_exchange_weak(old, result));
+				return Integer(result);
+			}
+
+			case Builtin::CompareSwap: {
+				auto &target = segment(call, values[0]).cell(index(call, values[1], segment(call, values[0]).size()));
+				auto expected = cell(call, values[2], 3);
+				return target.compare_exchange_strong(expected, cell(call, values[3], 4));
+			}
+
+			case Builtin::Accumulate: {
+				auto &target = array(call, values[0]);
+				if (!values[2].is<Integer>() && !values[2].is<String>()) {
+					fail(call.function.token, " requires 3. operand to be an integer or a string");
+				}
+				std::lock_guard<std::mutex> guard(target.lock());
+				auto &element = target.elements()[index(call, values[1], target.elements().size())];
+				if (!element.is<Integer>() && !element.is<String>()) {
+					fail(call.function.token, " requires the element to be an integer or a string");
+				}
+				return element = element + values[2];
+			}
+
+			default:
+				fail(call.function.token, " is not a builtin");
+		}
+	}
+
+	/*
+	 * Spawn("Name" arguments...) starts the function as a coroutine. It runs
+	 * whenever the running one waits: in Await, or in Read, Write, Sleep,
+	 * ChanSend and ChanRecv which would block.
+	 */
+	Value spawn(Call &call, std::vector<Value> &values)
+	{
+		auto func = namedFunction(call, values[0]);
+		std::vector<Value> arguments(values.begin() + 1, values.end());
+		if (func->parameters.size() != arguments.size()) {
+			fail(call.function.token, ": the number of given arguments is different than number of required arguments");
+		}
+
+		if (coroutines == nullptr) {
+			coroutines.reset(new Coroutines<CallStack>(environment.callStack));
+			coroutineResults.resize(1);
+		}
+		auto handle = coroutines->spawn([this, func, arguments] {
+			auto value = invoke(func, arguments);
+			coroutineResults[coroutines->current] = value;
+		});
+		coroutineResults.resize(handle + 1, Value(0));
+		return Integer(handle);
+	}
+
+	/*
+	 * ForkMap("Name" from to workers) calls the function with every number
+	 * from .. to in forked worker processes and returns the array of the
+	 * values. Nothing the function changes is seen by the caller.
+	 *
+	 * It can not be called within pfor: a child of a process with several
+	 * threads could find a lock held by a thread which it does not have.
+	 */
+	Value forkMap(Call &call, std::vector<Value> &values)
+	{
+		if (threaded) {
+			fail(call.function.token, ": the process can not fork while other threads run pfor");
+		}
+		auto func = namedFunction(call, values[0]);
+		if (func->parameters.size() != 1) {
+			fail(call.function.token, ": " + values[0].get<String>().str() + " has to take one argument");
+		}
+		for (std::size_t i = 1; i < 3; i++) {
+			if (!values[i].is<Integer>() || !values[i].get<Integer>().fits(INT_MIN, INT_MAX)) {
+				fail(call.function.token, " requires " + std::to_string(i + 1) + ". operand to fit into int");
+			}
+		}
+		if (!values[3].is<Integer>() || !values[3].get<Integer>().fits(1, INT_MAX)) {
+			fail(call.function.token, " requires 4. operand to be a positive integer");
+		}
+
+		auto from = values[1].get<Integer>().small();
+		auto count = std::max<std::int64_t>(values[2].get<Integer>().small() - from + 1, 0);
+		auto workers = std::min<std::int64_t>(values[3].get<Integer>().small(), count);
+		Array result;
+		result.elements() = ::ForkMap<RuntimeError>(workers).run(count, [&](std::int64_t iteration) {
+			return invoke(func, {Integer(from + iteration)});
+		});
+		result.settle();
+		return result;
+	}
+
+	/*
+	 * Segment("name" size) maps the shared memory object of the name, which is
+	 * created or grown to hold at least size integers. It stays in the system
+	 * until DropSegment("name").
+	 */
+	Value openSegment(Call &call, std::vector<Value> &values)
+	{
+		auto name = segmentName(call, values[0]);
+		if (!values[1].is<Integer>() || !values[1].get<Integer>().fits(1, INT_MAX)) {
+			fail(call.function.token, " requires 2. operand to be a positive integer");
+		}
+		off_t size = values[1].get<Integer>().small() * sizeof(std::int64_t);
+
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd < 0) {
+			fail(call.function.token, ": " + std::string(strerror(errno)));
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (st.st_size < size && ftruncate(fd, size) != 0)) {
+			auto error = errno;
+			close(fd);
+			fail(call.function.token, ": " + std::string(strerror(error)));
+		}
+		try {
+			return Segment(values[0].get<String>().str(), fd);
+		}
+		catch (brick::mmap::SystemException &e) {
+			close(fd);
+			fail(call.function.token, ": " + std::string(e.what()));
+		}
+	}
+
+	std::string segmentName(Call &call, Value &name)
+	{
+		if (!name.is<String>() || name.get<String>().empty() || name.get<String>().size() > NAME_MAX ||
+		    name.get<String>().str().find('/') != std::string::npos) {
+			fail(call.function.token, " requires 1. operand to be a name without slashes");
+		}
+		return "/" + name.get<String>().str();
+	}
+
+	Func *namedFunction(Call &call, Value &name)
+	{
+		if (!name.is<String>()) {
+			fail(call.function.token, " requires 1. operand to be a function name");
+		}
+		auto func = findFunction(name.get<String>().str());
+		if (func == nullptr) {
+			fail(call.function.token, ": " + name.get<String>().str() + " is not a function");
+		}
+		return func;
+	}
+
+	// lets the other coroutines run while the descriptor is not ready
+	void ready(Call &call, int fd, short events)
+	{
+		if (coroutines != nullptr && !coroutines->wait(fd, events)) {
+			fail(call.function.token, ": all coroutines are waiting for each other");
+		}
+	}
+
+	/*
+	 * Waits until a channel is ready for ChanSend or ChanRecv. Other coroutines
+	 * run in the meantime; other threads of pfor are waited for, unless all of
+	 * them wait as well.
+	 */
+	void ready(Call &call, std::function<bool()> condition)
+	{
+		while (!condition()) {
+			if (coroutines != nullptr && coroutines->until(condition)) {
+				continue;
+			}
+			if (!threaded) {
+				fail(call.function.token, ": the channel would wait forever");
+			}
+			Waits::Entry entry(*waits, condition);
+			while (!condition()) {
+				if (waits->deadlock()) {
+					fail(call.function.token, ": all threads wait for channels");
+				}
+				checkBudget();
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	/*
+	 * Runs at loop back-edges and calls, so that neither a loop nor recursion
+	 * can run past the limits. The statements are added to the shared count
+	 * and the clock is read only on every 256th check.
+	 */
+	void checkBudget()
+	{
+		if (budget == nullptr) {
+			return;
+		}
+		if (++checks % 256 == 0) {
+			budget->statements += statements;
+			statements = 0;
+			if (limits.time.count() != 0 && Budget::Clock::now() > budget->deadline) {
+				throw RuntimeError("the run took longer than " + std::to_string(limits.time.count()) + " ms");
+			}
+		}
+		if (limits.statements != 0 && budget->statements.load(std::memory_order_relaxed) + statements > limits.statements) {
+			throw RuntimeError("the run executed more than " + std::to_string(limits.statements) + " statements");
+		}
+	}
+
+	// coroutines still running when the program ends are finished first
+	void finishCoroutines()
+	{
+		for (std::size_t i = 1; coroutines != nullptr && i < coroutines->coroutines.size(); i++) {
+			if (!coroutines->await(i)) {
+				throw RuntimeError("all coroutines are waiting for each other");
+			}
+		}
+	}
+
+	// arrays and maps are only shared between threads by the workers of pfor
+	std::unique_lock<std::mutex> shared(std::mutex &lock)
+	{
+		return threaded ? std::unique_lock<std::mutex>(lock) : std::unique_lock<std::mutex>();
+	}
+
+	Array &array(Call &call, Value &value)
+	{
+		if (!value.is<Array>()) {
+			fail(call.function.token, " requires 1. operand to be an array");
+		}
+		return value.get<Array>();
+	}
+
+	Map &map(Call &call, Value &value)
+	{
+		if (!value.is<Map>()) {
+			fail(call.function.token, " requires 1. operand to be a map");
+		}
+		return value.get<Map>();
+	}
+
+	Channel &channel(Call &call, Value &value)
+	{
+		if (!value.is<Channel>()) {
+			fail(call.function.token, " requires 1. operand to be a channel");
+		}
+		return value.get<Channel>();
+	}
+
+	Segment &segment(Call &call, Value &value)
+	{
+		if (!value.is<Segment>()) {
+			fail(call.function.token, " requires 1. operand to be a shared segment");
+		}
+		return value.get<Segment>();
+	}
+
+	// what a shared cell can hold
+	std::int64_t cell(Call &call, Value &value, int position)
+	{
+		if (!value.is<Integer>() || !value.get<Integer>().isSmall()) {
+			fail(call.function.token, " requires " + std::to_string(position) + ". operand to be a 64-bit integer");
+		}
+		return value.get<Integer>().small();
+	}
+
+	Value &key(Call &call, Value &value)
+	{
+		if (!value.is<Integer>() && !value.is<String>()) {
+			fail(call.function.token, " requires 2. operand to be an integer or a string");
 		}
 		return value;
 	}
 
+	std::size_t index(Call &call, Value &value, std::size_t size)
+	{
+		if (!value.is<Integer>()) {
+			fail(call.function.token, " requires 2. operand to be an integer");
+		}
+		if (!value.get<Integer>().fits(0, static_cast<std::int64_t>(size) - 1)) {
+			fail(call.function.token, ": index " + value.get<Integer>().toString() + " is out of range");
+		}
+		return static_cast<std::size_t>(value.get<Integer>().small());
+	}
+
 	Value writeCall(Call &call, std::vector<Value> &arguments) {
 		if (arguments.size() != 1) {
 			fail(call, "requires one argument");
@@ -468,15 +1345,10 @@ private:
 		using write_func_ptr = int (*)(int, const void*, int);
 		write_func_ptr w = (write_func_ptr) dlsym(NULL, "write");
 
-		auto value = arguments[0];
 		std::string str;
-		if (value.is<std::string>()) {
-			str = value.get<std::string>();
-		}
-		else if (value.is<int>()) {
-			str = std::to_string(value.get<int>());
-		}
+		concatenate(str, arguments[0]);
 
+		ready(call, 1, POLLOUT);
 		return w(1, str.c_str(), (int)str.size());
 	}
 
@@ -496,6 +1368,7 @@ private:
 		char buffer[1];
 
 		while (true) {
+			ready(call, 0, POLLIN);
 			if (r (0, buffer, 1) > 0) {
 				if (buffer[0] == '\n') {
 					break;
@@ -508,13 +1381,13 @@ private:
 			}
 		}
 
-		int num;
+		Integer num;
 		auto identifier = arguments[0].get<Identifier>();
 		if (convertStringToInt(input, num)) {
 			environment.var(identifier, currentScope) = num;
 		}
 		else {
-			environment.var(identifier, currentScope) = input;
+			environment.var(identifier, currentScope) = String(input);
 		}
 
 		return retValue;
@@ -525,7 +1398,7 @@ private:
 
 	template <typename fake>
 	struct callSystemCall<0, fake> {
-		int operator()(std::string name, std::vector<int> values)
+		int operator()(std::string name, std::vector<int>)
 		{
 			no_args_func_ptr call = (no_args_func_ptr) dlsym(NULL, name.c_str());
 			return call();
@@ -573,11 +1446,25 @@ private:
 		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
 
 		std::vector<int> values;
-		for (int i = 0; i < arguments.size(); ++i) {
-			if (!arguments[i].is<int>()) {
+		for (std::size_t i = 0; i < arguments.size(); ++i) {
+			if (!arguments[i].is<Integer>()) {
 				fail(call, " requires " + std::to_string(i+1) + ". operand to be an integer");
 			}
-			values.push_back(std::move(arguments[i].get<int>()));
+			if (!arguments[i].get<Integer>().fits(INT_MIN, INT_MAX)) {
+				fail(call, " requires " + std::to_string(i+1) + ". operand to fit into int");
+			}
+			values.push_back(static_cast<int>(arguments[i].get<Integer>().small()));
+		}
+
+		// a coroutine sleeps without blocking the others
+		if (coroutines != nullptr && (name == "sleep" || name == "usleep") && values.size() == 1) {
+			if (name == "sleep") {
+				coroutines->sleep(std::chrono::seconds(values[0]));
+			}
+			else {
+				coroutines->sleep(std::chrono::microseconds(values[0]));
+			}
+			return 0;
 		}
 
 		switch (values.size()) {
@@ -596,7 +1483,7 @@ private:
 		}
 	}
 
-	bool convertStringToInt(std::string str, int &value) {
+	bool convertStringToInt(std::string str, Integer &value) {
 		if (str.empty()) {
 			return false;
 		}
@@ -604,8 +1491,8 @@ private:
 		if (copy[0] == '-' || copy[0] == '+') {
 			copy = copy.substr(1);
 		}
-		if (hasOnlyDigits(copy)) {
-			value = std::stoi(str);
+		if (!copy.empty() && hasOnlyDigits(copy)) {
+			value = Integer::parse(str);
 			return true;
 		}
 		return false;
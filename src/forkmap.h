@@ -0,0 +1,349 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <brick-proc>
+#include "value.h"
+
+/*
+ * Runs the iterations 0 .. count - 1 of a map in forked worker processes.
+ * Every worker takes an equal share of consecutive iterations and sends
+ * their values back through a pipe. All pipes are read as their data comes,
+ * so no worker waits for a full pipe, and the values are then taken in the
+ * order of the workers, which is the order of the iterations. An Error
+ * thrown by an iteration ends its worker and is thrown again by run, as is
+ * the end of a worker which did not send all of its values.
+ *
+ * A value is sent as a tag and LEB128 numbers. Arrays and maps are sent by
+ * their contents; channels and shared segments can not leave the process.
+ */
+template <typename Error>
+struct ForkMap
+{
+	using Body = std::function<Value(std::int64_t iteration)>;
+
+	std::size_t workers;
+
+	ForkMap(std::size_t workers) : workers(workers) {}
+
+	std::vector<Value> run(std::int64_t count, Body body)
+	{
+		std::vector<std::unique_ptr<brick::proc::Pipe>> pipes;
+		std::vector<pid_t> children;
+		std::string error;
+
+		// the children would write what is buffered once more
+		std::cout.flush();
+		for (std::size_t i = 0; i < workers; i++) {
+			std::unique_ptr<brick::proc::Pipe> pipe(new brick::proc::Pipe);
+			auto pid = fork();
+			if (pid < 0) {
+				error = "fork failed";
+				break;
+			}
+			if (pid == 0) {
+				pipe->closeRead();
+				work(begin(count, i), begin(count, i + 1), body, *pipe);
+			}
+			pipe->closeWrite();
+			pipes.push_back(std::move(pipe));
+			children.push_back(pid);
+		}
+
+		auto data = drain(pipes);
+		std::vector<Value> results;
+		results.reserve(count);
+		for (std::size_t i = 0; i < pipes.size(); i++) {
+			if (error.empty()) {
+				error = collect(data[i], begin(count, i + 1) - begin(count, i), results);
+			}
+		}
+		for (auto pid : children) {
+			waitpid(pid, nullptr, 0);
+		}
+
+		if (!error.empty()) {
+			throw Error(error);
+		}
+		return results;
+	}
+
+private:
+	enum Tag : std::uint8_t
+	{
+		SmallInteger, BigInteger, String, Array, Map, Failure
+	};
+
+	// values are sent once this much of them is ready
+	static const std::size_t chunkSize = 64 << 10;
+
+	std::int64_t begin(std::int64_t count, std::size_t worker) const
+	{
+		return count * static_cast<std::int64_t>(worker) / static_cast<std::int64_t>(workers);
+	}
+
+	[[noreturn]] void work(std::int64_t begin, std::int64_t end, Body &body, brick::proc::Pipe &pipe)
+	{
+		Writer writer;
+		try {
+			for (auto i = begin; i < end; i++) {
+				writer.value(body(i));
+				if (writer.out.size() >= chunkSize) {
+					pipe.push(writer.take());
+				}
+			}
+		}
+		catch (Error &e) {
+			writer.failure(e.message);
+		}
+		catch (...) {
+			writer.failure("a worker process failed");
+		}
+		pipe.push(writer.take());
+		std::cout.flush();
+		_exit(0);
+	}
+
+	// reads every pipe until its worker closes it
+	static std::vector<std::string> drain(std::vector<std::unique_ptr<brick::proc::Pipe>> &pipes)
+	{
+		std::vector<std::string> data(pipes.size());
+		std::vector<std::size_t> open;
+		for (std::size_t i = 0; i < pipes.size(); i++) {
+			open.push_back(i);
+		}
+
+		std::vector<char> buffer(chunkSize);
+		while (!open.empty()) {
+			std::vector<pollfd> requests;
+			for (auto i : open) {
+				requests.push_back(pollfd{pipes[i]->read(), POLLIN, 0});
+			}
+			if (poll(requests.data(), requests.size(), -1) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+
+			std::vector<std::size_t> left;
+			for (std::size_t j = 0; j < open.size(); j++) {
+				auto i = open[j];
+				auto n = requests[j].revents != 0 ? read(pipes[i]->read(), buffer.data(), buffer.size()) : -1;
+				if (n > 0) {
+					data[i].append(buffer.data(), n);
+				}
+				if (n == 0 || (n < 0 && requests[j].revents != 0 && errno != EINTR)) {
+					pipes[i]->closeRead();
+				}
+				else {
+					left.push_back(i);
+				}
+			}
+			std::swap(open, left);
+		}
+		return data;
+	}
+
+	// returns the error of the worker, if any
+	std::string collect(const std::string &data, std::int64_t count, std::vector<Value> &results)
+	{
+		Reader reader{data};
+		try {
+			for (std::int64_t i = 0; i < count; i++) {
+				if (reader.failed()) {
+					return reader.text();
+				}
+				results.push_back(reader.value());
+			}
+		}
+		catch (Truncated) {
+			return "a worker process ended before sending all values";
+		}
+		return std::string();
+	}
+
+	struct Truncated {};
+
+	struct Writer
+	{
+		std::string out;
+
+		void number(std::uint64_t n)
+		{
+			do {
+				std::uint8_t byte = n & 0x7f;
+				n >>= 7;
+				out.push_back(static_cast<char>(n ? (byte | 0x80) : byte));
+			} while (n);
+		}
+
+		void text(const std::string &s)
+		{
+			number(s.size());
+			out.append(s);
+		}
+
+		// a value which can not be sent leaves nothing behind
+		void value(const Value &v)
+		{
+			auto size = out.size();
+			try {
+				encode(v);
+			}
+			catch (...) {
+				out.resize(size);
+				throw;
+			}
+		}
+
+		void failure(const std::string &message)
+		{
+			out.push_back(Failure);
+			text(message);
+		}
+
+		std::string take()
+		{
+			std::string result;
+			std::swap(result, out);
+			return result;
+		}
+
+	private:
+		void encode(const Value &v)
+		{
+			if (v.is<::String>()) {
+				out.push_back(String);
+				text(v.get<::String>().str());
+			}
+			else if (v.is<Integer>() && v.get<Integer>().isSmall()) {
+				auto i = v.get<Integer>().small();
+				out.push_back(SmallInteger);
+				// zigzag keeps small negative numbers short
+				number((static_cast<std::uint64_t>(i) << 1) ^ static_cast<std::uint64_t>(i >> 63));
+			}
+			else if (v.is<Integer>()) {
+				out.push_back(BigInteger);
+				text(v.get<Integer>().toString());
+			}
+			else if (v.is<::Array>()) {
+				auto &elements = v.get<::Array>().elements();
+				Visiting visiting(v.get<::Array>().identity());
+				if (visiting.repeated) {
+					throw Error("an array which holds itself can not be passed between processes");
+				}
+				out.push_back(Array);
+				number(elements.size());
+				for (auto &element : elements) {
+					encode(element);
+				}
+			}
+			else if (v.is<::Map>()) {
+				auto &map = v.get<::Map>();
+				Visiting visiting(map.identity());
+				if (visiting.repeated) {
+					throw Error("a map which holds itself can not be passed between processes");
+				}
+				auto keys = map.keys();
+				out.push_back(Map);
+				number(keys.size());
+				for (auto &key : keys) {
+					encode(key);
+					encode(*map.find(key));
+				}
+			}
+			else if (v.is<Channel>()) {
+				throw Error("a channel can not be passed between processes");
+			}
+			else {
+				throw Error("a shared segment can not be passed between processes, it is shared by its name");
+			}
+		}
+	};
+
+	struct Reader
+	{
+		const std::string &data;
+		std::size_t position = 0;
+
+		std::uint8_t byte()
+		{
+			if (position >= data.size()) {
+				throw Truncated();
+			}
+			return static_cast<std::uint8_t>(data[position++]);
+		}
+
+		std::uint64_t number()
+		{
+			std::uint64_t n = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				auto b = byte();
+				n |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+				if (!(b & 0x80)) {
+					return n;
+				}
+			}
+			throw Truncated();
+		}
+
+		std::string text()
+		{
+			auto size = number();
+			if (size > data.size() - position) {
+				throw Truncated();
+			}
+			position += size;
+			return data.substr(position - size, size);
+		}
+
+		bool failed()
+		{
+			if (position < data.size() && data[position] == Failure) {
+				++position;
+				return true;
+			}
+			return false;
+		}
+
+		Value value()
+		{
+			switch (byte()) {
+				case SmallInteger: {
+					auto n = number();
+					return Integer(static_cast<std::int64_t>((n >> 1) ^ (~(n & 1) + 1)));
+				}
+				case BigInteger:
+					return Integer::parse(text());
+				case String:
+					return ::String(text());
+				case Array: {
+					::Array array(number());
+					for (auto &element : array.elements()) {
+						element = value();
+					}
+					return array;
+				}
+				case Map: {
+					::Map map;
+					for (auto size = number(); size > 0; size--) {
+						auto key = value();
+						map.put(key, value());
+					}
+					return map;
+				}
+				default:
+					throw Truncated();
+			}
+		}
+	};
+};
\ No newline at end of file
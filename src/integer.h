@@ -0,0 +1,394 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Integers are kept in a plain 64-bit value while they fit; an operation
+ * which overflows it continues on the magnitude (base 2^32, least
+ * significant digit first) and its result is narrowed back when possible.
+ */
+struct Integer
+{
+	using Digits = std::vector<std::uint32_t>;
+
+	Integer(std::int64_t value = 0) : value(value) {}
+
+	static Integer parse(const std::string &text)
+	{
+		bool negative = !text.empty() && text[0] == '-';
+		std::size_t begin = (negative || (!text.empty() && text[0] == '+')) ? 1 : 0;
+
+		if (text.size() - begin <= 18) {
+			return std::stoll(text);
+		}
+
+		Digits digits;
+		std::size_t chunk = (text.size() - begin) % 9;
+		for (std::size_t i = begin; i < text.size(); i += chunk, chunk = 9) {
+			if (chunk == 0) {
+				chunk = 9;
+			}
+			multiply(digits, 1000000000);
+			add(digits, static_cast<std::uint32_t>(std::stoul(text.substr(i, chunk))));
+		}
+		return Integer(negative, std::move(digits));
+	}
+
+	bool isSmall() const
+	{
+		return big == nullptr;
+	}
+
+	std::int64_t small() const
+	{
+		return value;
+	}
+
+	bool isZero() const
+	{
+		return isSmall() && value == 0;
+	}
+
+	bool fits(std::int64_t min, std::int64_t max) const
+	{
+		return isSmall() && value >= min && value <= max;
+	}
+
+	std::string toString() const
+	{
+		if (isSmall()) {
+			return std::to_string(value);
+		}
+
+		Digits digits = big->digits;
+		std::string result;
+		while (!digits.empty()) {
+			auto chunk = std::to_string(divide(digits, 1000000000));
+			if (!digits.empty()) {
+				chunk.insert(0, 9 - chunk.size(), '0');
+			}
+			result.insert(0, chunk);
+		}
+		return (big->negative ? "-" : "") + result;
+	}
+
+	Integer operator-() const
+	{
+		if (isSmall() && value != INT64_MIN) {
+			return -value;
+		}
+		auto digits = magnitude();
+		return Integer(!negative(), std::move(digits));
+	}
+
+	friend Integer operator+(const Integer &lhs, const Integer &rhs)
+	{
+		std::int64_t result;
+		if (lhs.isSmall() && rhs.isSmall() && !__builtin_add_overflow(lhs.value, rhs.value, &result)) {
+			return result;
+		}
+		return sum(lhs.negative(), lhs.magnitude(), rhs.negative(), rhs.magnitude());
+	}
+
+	friend Integer operator-(const Integer &lhs, const Integer &rhs)
+	{
+		std::int64_t result;
+		if (lhs.isSmall() && rhs.isSmall() && !__builtin_sub_overflow(lhs.value, rhs.value, &result)) {
+			return result;
+		}
+		return sum(lhs.negative(), lhs.magnitude(), !rhs.negative(), rhs.magnitude());
+	}
+
+	friend Integer operator*(const Integer &lhs, const Integer &rhs)
+	{
+		std::int64_t result;
+		if (lhs.isSmall() && rhs.isSmall() && !__builtin_mul_overflow(lhs.value, rhs.value, &result)) {
+			return result;
+		}
+		return Integer(lhs.negative() != rhs.negative(), multiply(lhs.magnitude(), rhs.magnitude()));
+	}
+
+	// truncates towards zero like int does
+	friend Integer operator/(const Integer &lhs, const Integer &rhs)
+	{
+		if (lhs.isSmall() && rhs.isSmall() && !(lhs.value == INT64_MIN && rhs.value == -1)) {
+			return lhs.value / rhs.value;
+		}
+		Digits quotient, remainder;
+		divide(lhs.magnitude(), rhs.magnitude(), quotient, remainder);
+		return Integer(lhs.negative() != rhs.negative(), std::move(quotient));
+	}
+
+	// takes the sign of the dividend like int does
+	friend Integer operator%(const Integer &lhs, const Integer &rhs)
+	{
+		if (lhs.isSmall() && rhs.isSmall()) {
+			return (rhs.value == -1) ? 0 : lhs.value % rhs.value;
+		}
+		Digits quotient, remainder;
+		divide(lhs.magnitude(), rhs.magnitude(), quotient, remainder);
+		return Integer(lhs.negative(), std::move(remainder));
+	}
+
+	friend bool operator==(const Integer &lhs, const Integer &rhs)
+	{
+		return compare(lhs, rhs) == 0;
+	}
+
+	friend bool operator<(const Integer &lhs, const Integer &rhs)
+	{
+		return compare(lhs, rhs) < 0;
+	}
+
+private:
+	struct Big
+	{
+		bool negative;
+		Digits digits;
+	};
+
+	std::int64_t value;
+	std::shared_ptr<const Big> big;
+
+	Integer(bool negative, Digits &&digits) : value(0)
+	{
+		trim(digits);
+		if (digits.size() <= 2) {
+			std::uint64_t magnitude = digits.empty() ? 0 : digits[0];
+			if (digits.size() == 2) {
+				magnitude |= std::uint64_t(digits[1]) << 32;
+			}
+			if (magnitude <= std::uint64_t(INT64_MAX)) {
+				value = negative ? -std::int64_t(magnitude) : std::int64_t(magnitude);
+				return;
+			}
+			if (negative && magnitude == std::uint64_t(INT64_MAX) + 1) {
+				value = INT64_MIN;
+				return;
+			}
+		}
+		big = std::make_shared<const Big>(Big{negative, std::move(digits)});
+	}
+
+	bool negative() const
+	{
+		return isSmall() ? value < 0 : big->negative;
+	}
+
+	Digits magnitude() const
+	{
+		if (!isSmall()) {
+			return big->digits;
+		}
+		std::uint64_t magnitude = (value < 0) ? 0 - std::uint64_t(value) : std::uint64_t(value);
+		Digits digits{std::uint32_t(magnitude), std::uint32_t(magnitude >> 32)};
+		trim(digits);
+		return digits;
+	}
+
+	static int compare(const Integer &lhs, const Integer &rhs)
+	{
+		if (lhs.isSmall() && rhs.isSmall()) {
+			return (lhs.value > rhs.value) - (lhs.value < rhs.value);
+		}
+		if (lhs.negative() != rhs.negative()) {
+			return lhs.negative() ? -1 : 1;
+		}
+		int result = compare(lhs.magnitude(), rhs.magnitude());
+		return lhs.negative() ? -result : result;
+	}
+
+	static int compare(const Digits &lhs, const Digits &rhs)
+	{
+		if (lhs.size() != rhs.size()) {
+			return (lhs.size() < rhs.size()) ? -1 : 1;
+		}
+		for (std::size_t i = lhs.size(); i-- > 0;) {
+			if (lhs[i] != rhs[i]) {
+				return (lhs[i] < rhs[i]) ? -1 : 1;
+			}
+		}
+		return 0;
+	}
+
+	static void trim(Digits &digits)
+	{
+		while (!digits.empty() && digits.back() == 0) {
+			digits.pop_back();
+		}
+	}
+
+	static Integer sum(bool lhsNegative, Digits lhs, bool rhsNegative, const Digits &rhs)
+	{
+		if (lhsNegative == rhsNegative) {
+			std::uint64_t carry = 0;
+			lhs.resize(std::max(lhs.size(), rhs.size()));
+			for (std::size_t i = 0; i < lhs.size(); ++i) {
+				carry += std::uint64_t(lhs[i]) + (i < rhs.size() ? rhs[i] : 0);
+				lhs[i] = std::uint32_t(carry);
+				carry >>= 32;
+			}
+			if (carry) {
+				lhs.push_back(std::uint32_t(carry));
+			}
+			return Integer(lhsNegative, std::move(lhs));
+		}
+
+		if (compare(lhs, rhs) < 0) {
+			return sum(rhsNegative, rhs, lhsNegative, lhs);
+		}
+		std::int64_t borrow = 0;
+		for (std::size_t i = 0; i < lhs.size(); ++i) {
+			std::int64_t digit = std::int64_t(lhs[i]) - (i < rhs.size() ? rhs[i] : 0) - borrow;
+			borrow = digit < 0;
+			lhs[i] = std::uint32_t(digit + (borrow << 32));
+		}
+		return Integer(lhsNegative, std::move(lhs));
+	}
+
+	static Digits multiply(const Digits &lhs, const Digits &rhs)
+	{
+		if (lhs.size() < rhs.size()) {
+			return multiply(rhs, lhs);
+		}
+		if (rhs.size() == 1) {
+			Digits result = lhs;
+			multiply(result, rhs[0]);
+			return result;
+		}
+
+		Digits result(lhs.size() + rhs.size());
+		for (std::size_t j = 0; j < rhs.size(); ++j) {
+			std::uint64_t carry = 0;
+			for (std::size_t i = 0; i < lhs.size(); ++i) {
+				carry += std::uint64_t(lhs[i]) * rhs[j] + result[i + j];
+				result[i + j] = std::uint32_t(carry);
+				carry >>= 32;
+			}
+			result[j + lhs.size()] = std::uint32_t(carry);
+		}
+		return result;
+	}
+
+	static void multiply(Digits &digits, std::uint32_t factor)
+	{
+		std::uint64_t carry = 0;
+		for (auto &digit : digits) {
+			carry += std::uint64_t(digit) * factor;
+			digit = std::uint32_t(carry);
+			carry >>= 32;
+		}
+		if (carry) {
+			digits.push_back(std::uint32_t(carry));
+		}
+	}
+
+	static void add(Digits &digits, std::uint32_t addend)
+	{
+		std::uint64_t carry = addend;
+		for (std::size_t i = 0; carry && i < digits.size(); ++i) {
+			carry += digits[i];
+			digits[i] = std::uint32_t(carry);
+			carry >>= 32;
+		}
+		if (carry) {
+			digits.push_back(std::uint32_t(carry));
+		}
+	}
+
+	// divides in place, returns the remainder
+	static std::uint32_t divide(Digits &digits, std::uint32_t divisor)
+	{
+		std::uint64_t remainder = 0;
+		for (std::size_t i = digits.size(); i-- > 0;) {
+			remainder = (remainder << 32) | digits[i];
+			digits[i] = std::uint32_t(remainder / divisor);
+			remainder %= divisor;
+		}
+		trim(digits);
+		return std::uint32_t(remainder);
+	}
+
+	// Knuth's algorithm D, the divisor must not be zero
+	static void divide(const Digits &u, const Digits &v, Digits &quotient, Digits &remainder)
+	{
+		if (compare(u, v) < 0) {
+			quotient.clear();
+			remainder = u;
+			return;
+		}
+		if (v.size() == 1) {
+			quotient = u;
+			remainder = Digits{divide(quotient, v[0])};
+			trim(remainder);
+			return;
+		}
+
+		const std::uint64_t base = std::uint64_t(1) << 32;
+		std::size_t n = v.size(), m = u.size();
+		int shift = __builtin_clz(v[n - 1]);
+
+		Digits vn(n), un(m + 1);
+		for (std::size_t i = n - 1; i > 0; --i) {
+			vn[i] = std::uint32_t((std::uint64_t(v[i]) << shift) | (std::uint64_t(v[i - 1]) >> (32 - shift)));
+		}
+		vn[0] = v[0] << shift;
+		un[m] = std::uint32_t(std::uint64_t(u[m - 1]) >> (32 - shift));
+		for (std::size_t i = m - 1; i > 0; --i) {
+			un[i] = std::uint32_t((std::uint64_t(u[i]) << shift) | (std::uint64_t(u[i - 1]) >> (32 - shift)));
+		}
+		un[0] = u[0] << shift;
+
+		quotient.assign(m - n + 1, 0);
+		for (std::size_t j = m - n + 1; j-- > 0;) {
+			std::uint64_t numerator = (std::uint64_t(un[j + n]) << 32) | un[j + n - 1];
+			std::uint64_t qhat = numerator / vn[n - 1];
+			std::uint64_t rhat = numerator % vn[n - 1];
+			while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+				--qhat;
+				rhat += vn[n - 1];
+				if (rhat >= base) {
+					break;
+				}
+			}
+
+			std::int64_t borrow = 0, t;
+			for (std::size_t i = 0; i < n; ++i) {
+				std::uint64_t product = qhat * vn[i];
+				t = std::int64_t(un[i + j]) - borrow - std::int64_t(product & 0xffffffff);
+				un[i + j] = std::uint32_t(t);
+				borrow = std::int64_t(product >> 32) - (t >> 32);
+			}
+			t = std::int64_t(un[j + n]) - borrow;
+			un[j + n] = std::uint32_t(t);
+
+			quotient[j] = std::uint32_t(qhat);
+			if (t < 0) {
+				--quotient[j];
+				std::uint64_t carry = 0;
+				for (std::size_t i = 0; i < n; ++i) {
+					carry += std::uint64_t(un[i + j]) + vn[i];
+					un[i + j] = std::uint32_t(carry);
+					carry >>= 32;
+				}
+				un[j + n] = std::uint32_t(un[j + n] + carry);
+			}
+		}
+
+		remainder.resize(n);
+		for (std::size_t i = 0; i < n; ++i) {
+			remainder[i] = std::uint32_t((std::uint64_t(un[i]) >> shift) | (std::uint64_t(un[i + 1]) << (32 - shift)));
+		}
+		trim(quotient);
+		trim(remainder);
+	}
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Integer &i)
+{
+	return out << i.toString();
+}
\ No newline at end of file
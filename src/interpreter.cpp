@@ -0,0 +1,78 @@
+#include <sstream>
+#include "interpreter.h"
+#include "evaluator.h"
+
+template <typename T>
+static ScriptError scriptError(T error)
+{
+	std::stringstream s;
+	s << error;
+	return ScriptError(s.str());
+}
+
+// runs the function, errors of the script are thrown as ScriptError
+template <typename Function>
+static auto translate(Function function) -> decltype(function())
+{
+	try {
+		return function();
+	}
+	catch (BadParse bp) {
+		throw scriptError(bp);
+	}
+	catch (BadSymbol bs) {
+		throw scriptError(bs);
+	}
+	catch (BadArity ba) {
+		throw scriptError(ba);
+	}
+	catch (RuntimeError re) {
+		throw scriptError(re);
+	}
+}
+
+Program::Program(const std::string &file) : Program(file, Options()) {}
+
+Program::Program(const std::string &file, Options options)
+{
+	compile(std::make_shared<Evaluator>(file), options);
+}
+
+Program::Program(Source source) : Program(std::move(source), Options()) {}
+
+Program::Program(Source source, Options options)
+{
+	compile(std::make_shared<Evaluator>(std::move(source)), options);
+}
+
+void Program::compile(std::shared_ptr<Evaluator> evaluator, Options options)
+{
+	evaluator->analyzer->optimize = options.optimize;
+	evaluator->cache = options.cache;
+	evaluator->parallel = options.parallel;
+	evaluator->limits = options.limits;
+	evaluator->measureMemory = options.measureMemory;
+	translate([&] { evaluator->load(); });
+	compiled = evaluator;
+}
+
+Context::Context(const Program &program) : evaluator(new Evaluator(*program.compiled, Environment())) {}
+
+Context::Context(Context &&other) = default;
+
+Context::~Context() = default;
+
+std::vector<Value> Context::run()
+{
+	return translate([&] { return evaluator->run(); });
+}
+
+void Context::runAndPrint()
+{
+	translate([&] { evaluator->runAndPrint(); });
+}
+
+std::size_t Context::peakMemory() const
+{
+	return evaluator->memory != nullptr ? evaluator->memory->peak.load() : 0;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "budget.h"
+#include "lexer.h"
+#include "value.h"
+
+struct Evaluator;
+
+/*
+ * The interface of the interpreter library. A Program is a script parsed
+ * and analyzed once. It does not change afterwards, so any number of
+ * contexts on any threads may share it. A Context runs the program with
+ * variables of its own, as many times as needed.
+ *
+ * Errors found in the script while compiling or running it are thrown as
+ * ScriptError with the message the interpreter would print.
+ */
+struct ScriptError
+{
+	std::string message;
+	ScriptError(std::string m) : message(m) {}
+};
+
+static inline std::ostream &operator<<(std::ostream &out, ScriptError se)
+{
+	out << se.message;
+	return out;
+}
+
+struct Program
+{
+	struct Options
+	{
+		bool optimize = true;
+		// keeps the analyzed program in a file next to the script
+		bool cache = false;
+		// parses large scripts in chunks and evaluates independent top-level calls at once
+		bool parallel = false;
+		// applies to every run of the program
+		Limits limits;
+		// counts memory even without a limit, see Context::peakMemory
+		bool measureMemory = false;
+	};
+
+	explicit Program(const std::string &file);
+	Program(const std::string &file, Options options);
+	explicit Program(Source source);
+	Program(Source source, Options options);
+
+private:
+	friend struct Context;
+	std::shared_ptr<const Evaluator> compiled;
+
+	void compile(std::shared_ptr<Evaluator> evaluator, Options options);
+};
+
+struct Context
+{
+	explicit Context(const Program &program);
+	Context(Context &&other);
+	~Context();
+
+	// returns the values of the top-level calls
+	std::vector<Value> run();
+	void runAndPrint();
+
+	// the most bytes held at once by the last run, if its memory was counted
+	std::size_t peakMemory() const;
+
+private:
+	std::unique_ptr<Evaluator> evaluator;
+};
\ No newline at end of file
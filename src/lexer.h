@@ -1,7 +1,10 @@
 #pragma once
 #include <fstream>
 #include <cctype>
-#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scan.h"
 
 struct Token
 {
@@ -9,7 +12,7 @@ struct Token
 	{
 		ParentOpen, ParentClose,
 		StringLit, NumericLit, Identifier,
-		If, Else, For, From, To, DownTo, While, Func, Var, Return,
+		If, Else, For, PFor, From, To, DownTo, While, Func, Var, Return,
 		Plus, Minus, Times, Slash, Modulo, Assign,
 		And, Or, Not,
 		Eq, NotEq, Less, LessEq, Greater, GreaterEq,
@@ -20,14 +23,24 @@ struct Token
 	int line;
 
 	Token(Category cat, std::string text, int line)
-		: category(cat), text(text), line(line)
+		: category(cat), text(std::move(text)), line(line)
 	{}
+
+	bool isOperator() const
+	{
+		return category >= Plus && category <= GreaterEq;
+	}
+
+	bool isKeyword() const
+	{
+		return category >= If && category <= Return;
+	}
 };
 
 static const char *categoryNames[] = {
 	"ParentOpen", "ParentClose",
 	"StringLit", "NumericLit", "Identifier",
-	"If", "Else", "For", "From", "To", "DownTo", "While", "Func", "Var", "Return",
+	"If", "Else", "For", "PFor", "From", "To", "DownTo", "While", "Func", "Var", "Return",
 	"Plus", "Minus", "Times", "Slash", "Modulo", "Assign",
 	"And", "Or", "Not",
 	"Eq", "NotEq", "Less", "LessEq", "Greater", "GreaterEq", 
@@ -39,38 +52,86 @@ static inline std::ostream &operator<<(std::ostream &out, const Token token) {
 	return out << "[" << categoryNames[token.category] << "] " << token.text << " at line " << token.line;
 }
 
+// the text of a script which does not come from a file
+struct Source
+{
+	std::string text;
+};
+
+/*
+ * The whole source is kept in memory, read from a file or given as it is,
+ * and scanned by position. Keywords and operators are recognized by switches
+ * on their length and characters, the category of a token tells which one
+ * it is.
+ */
 struct Lexer
 {
-	std::ifstream in;
+	std::string source;
+	std::size_t position = 0;
 	std::string buffer;
 	char c;
 	int line = 1;
 
-	std::map< std::string, Token::Category > operators;
-	std::map< std::string, Token::Category > keywords;
+	Lexer(const char *f) : Lexer(Source{read(f)}) {}
+
+	Lexer(std::string file) : Lexer(file.c_str()) {}
+
+	Lexer(Source s) : source(std::move(s.text)) {}
 
-	Lexer(const char *f) : in(f, std::ios::binary)
+	// where a global starts, line is the one a token there would have
+	struct Boundary
 	{
-		std::map< std::string, Token::Category > op {
-			{ "+", Token::Plus }, { "-", Token::Minus }, { "*", Token::Times }, { "/", Token::Slash }, { "%", Token::Modulo }, { "=", Token::Assign },
-			{ "&&", Token::And }, { "||", Token::Or }, { "!", Token::Not },
-			{ "==", Token::Eq }, { "!=", Token::NotEq }, { "<", Token::Less }, { "<=", Token::LessEq }, { ">", Token::Greater },{ ">=", Token::GreaterEq }
-		};
-		operators = std::move(op);
+		std::size_t position;
+		int line;
+	};
 
-		std::map< std::string, Token::Category > key {
-			{ "if", Token::If }, { "else", Token::Else }, { "for", Token::For }, { "from", Token::From }, { "to", Token::To }, { "downto", Token::DownTo },
-			{ "while", Token::While }, { "func", Token::Func }, { "var", Token::Var }, { "return", Token::Return }
-		};
-		keywords = std::move(key);
+	/*
+	 * The func and var keywords outside of all parentheses, each of them
+	 * starts a global. Strings are skipped as they are read and their
+	 * newlines are not counted, just as in tokens.
+	 */
+	std::vector<Boundary> boundaries() const
+	{
+		std::vector<Boundary> result;
+		std::size_t at = 0;
+		int lines = 1;
+		int depth = 0;
+		while ((at = scan::spaces(source, at, lines)) < source.size()) {
+			char first = source[at];
+			if (scan::word(first)) {
+				auto end = scan::word(source, at);
+				if (depth == 0 && (source.compare(at, end - at, "func") == 0 || source.compare(at, end - at, "var") == 0)) {
+					result.push_back(Boundary{at, lines});
+				}
+				at = end;
+				continue;
+			}
+			++at;
+			if (first == '(') {
+				++depth;
+			}
+			else if (first == ')') {
+				--depth;
+			}
+			else if (first == '"') {
+				// a backslash never hides the quote after it
+				while ((at = scan::plain(source, at)) < source.size() && source[at++] != '"') {}
+			}
+		}
+		return result;
 	}
 
-	Lexer(std::string file) : Lexer(file.c_str()) {}
+	// the source is not needed once it was parsed
+	void release()
+	{
+		source = std::string();
+		position = 0;
+	}
 
 	Token next()
 	{
 		whitespace();
-		buffer += (c = in.get());
+		buffer += (c = get());
 
 		if (c == EOF) {
 			return Token(Token::Eof, "", line);
@@ -100,34 +161,140 @@ struct Lexer
 
 	Token peek()
 	{
-		auto pos = in.tellg();
+		auto pos = position;
 		auto oldLine = line;
 		Token tok = next();
-		in.clear();
-		in.seekg(pos);
+		position = pos;
 		line = oldLine;
 		return tok;
 	}
 
-	bool isOperator(std::string text)
+	// Identifier when the word is no keyword
+	static Token::Category keyword(const std::string &word)
 	{
-		return operators.find(text) != operators.end();
+		switch (word.size()) {
+			case 2:
+				if (word[0] == 'i' && word[1] == 'f') {
+					return Token::If;
+				}
+				if (word[0] == 't' && word[1] == 'o') {
+					return Token::To;
+				}
+				break;
+			case 3:
+				if (word == "for") {
+					return Token::For;
+				}
+				if (word == "var") {
+					return Token::Var;
+				}
+				break;
+			case 4:
+				switch (word[0]) {
+					case 'e': return word == "else" ? Token::Else : Token::Identifier;
+					case 'p': return word == "pfor" ? Token::PFor : Token::Identifier;
+					case 'f':
+						if (word == "from") {
+							return Token::From;
+						}
+						return word == "func" ? Token::Func : Token::Identifier;
+				}
+				break;
+			case 5:
+				return word == "while" ? Token::While : Token::Identifier;
+			case 6:
+				if (word == "downto") {
+					return Token::DownTo;
+				}
+				if (word == "return") {
+					return Token::Return;
+				}
+				break;
+		}
+		return Token::Identifier;
 	}
 
-	bool isKeyword(std::string text)
+	// Error when the characters start no operator, length tells how many of them it takes
+	static Token::Category operatorSymbol(int first, int second, int &length)
 	{
-		return keywords.find(text) != keywords.end();
+		length = 2;
+		switch (first) {
+			case '+': length = 1; return Token::Plus;
+			case '-': length = 1; return Token::Minus;
+			case '*': length = 1; return Token::Times;
+			case '/': length = 1; return Token::Slash;
+			case '%': length = 1; return Token::Modulo;
+			case '&':
+				if (second == '&') {
+					return Token::And;
+				}
+				break;
+			case '|':
+				if (second == '|') {
+					return Token::Or;
+				}
+				break;
+			case '=':
+				if (second == '=') {
+					return Token::Eq;
+				}
+				length = 1;
+				return Token::Assign;
+			case '!':
+				if (second == '=') {
+					return Token::NotEq;
+				}
+				length = 1;
+				return Token::Not;
+			case '<':
+				if (second == '=') {
+					return Token::LessEq;
+				}
+				length = 1;
+				return Token::Less;
+			case '>':
+				if (second == '=') {
+					return Token::GreaterEq;
+				}
+				length = 1;
+				return Token::Greater;
+		}
+		length = 1;
+		return Token::Error;
 	}
 
 protected:
-	void whitespace()
+	// a missing file reads as an empty script
+	static std::string read(const char *file)
 	{
-		while (std::isspace(c = in.get())) {
-			if (c == '\n') {
-				++line;
-			}
+		std::ifstream in(file, std::ios::binary);
+		std::stringstream text;
+		text << in.rdbuf();
+		return text.str();
+	}
+
+	// reading past the end gives EOF, unget steps back over it
+	int get()
+	{
+		if (position++ < source.size()) {
+			return static_cast<unsigned char>(source[position - 1]);
 		}
-		in.unget();
+		return EOF;
+	}
+
+	void unget()
+	{
+		--position;
+	}
+
+	int look() const
+	{
+		return position < source.size() ? static_cast<unsigned char>(source[position]) : EOF;
+	}
+
+	void whitespace()
+	{
+		position = scan::spaces(source, position, line);
 	}
 
 	Token shift(Token::Category c)
@@ -139,32 +306,33 @@ protected:
 
 	Token identifier()
 	{
-		while (std::isalnum(c = in.get()) || c == '_') {
-			buffer += c;
-		}
-		in.unget();
-		if (isKeyword(buffer)) {
-			return shift(keywords[buffer]);
-		}
-		return shift(Token::Identifier);
+		auto end = scan::word(source, position);
+		buffer.append(source, position, end - position);
+		position = end;
+		return shift(keyword(buffer));
 	}
 
 	Token stringLiteral()
 	{
 		buffer.clear();
-		while ((c = in.get()) != '"') {
+		while (true) {
+			auto end = scan::plain(source, position);
+			buffer.append(source, position, end - position);
+			position = end;
+			if ((c = get()) == '"') {
+				break;
+			}
 			if (c == EOF) {
 				return shift(Token::Error);
 			}
-			if (c == '\\') {
-				char next = in.get();
-				if (next == 'n') {
-					buffer += '\n';
-					continue;
-				}
-				in.unget();
+			// the rest stopped at a backslash, which stands for itself unless n follows
+			if (look() == 'n') {
+				get();
+				buffer += '\n';
+			}
+			else {
+				buffer += c;
 			}
-			buffer += c;
 		}
 
 		return shift(Token::StringLit);
@@ -172,23 +340,21 @@ protected:
 
 	Token numericLiteral()
 	{
-		while (std::isdigit(c = in.get())) {
+		while (std::isdigit(c = get())) {
 			buffer += c;
 		}
-		in.unget();
+		unget();
 
 		return shift(Token::NumericLit);
 	}
 
 	Token operatorSymbol()
 	{
-		char next = in.peek();
-		if (isOperator(buffer + next)) {
-			buffer += in.get();
-		}
-		if (isOperator(buffer)) {
-			return shift(operators[buffer]);
+		int length;
+		auto category = operatorSymbol(static_cast<unsigned char>(c), look(), length);
+		if (length == 2) {
+			buffer += get();
 		}
-		return shift(Token::Error);
+		return shift(category);
 	}
 };
@@ -1,6 +1,10 @@
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <string>
 #include "analyzer.h"
+#include "daemon.h"
 #include "evaluator.h"
 
 using namespace std;
@@ -12,8 +16,74 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	Evaluator e(argv[1]);
 	try {
+		if (strcmp(argv[1], "--daemon") == 0 && argc == 3) {
+			Daemon(argv[2]).serve();
+			return 0;
+		}
+		if (strcmp(argv[1], "--client") == 0 && argc == 4) {
+			std::string file = argv[3];
+			if (file == "-") {
+				std::string source((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+				Daemon::send(argv[2], Daemon::sourceRequest(source), std::cout);
+			}
+			else {
+				Daemon::send(argv[2], Daemon::pathRequest(file), std::cout);
+			}
+			return 0;
+		}
+
+		int file = 1;
+		bool cache = false;
+		bool parallel = false;
+		Limits limits;
+		bool memoryStats = false;
+		for (; file < argc - 1; file++) {
+			if (strcmp(argv[file], "--cache") == 0) {
+				cache = true;
+			}
+			else if (strcmp(argv[file], "--parallel") == 0) {
+				parallel = true;
+			}
+			else if (strcmp(argv[file], "--max-statements") == 0 && file + 2 < argc) {
+				limits.statements = std::strtoull(argv[++file], nullptr, 10);
+			}
+			else if (strcmp(argv[file], "--max-depth") == 0 && file + 2 < argc) {
+				limits.depth = std::strtoull(argv[++file], nullptr, 10);
+			}
+			else if (strcmp(argv[file], "--timeout") == 0 && file + 2 < argc) {
+				limits.time = std::chrono::milliseconds(std::strtoull(argv[++file], nullptr, 10));
+			}
+			else if (strcmp(argv[file], "--max-memory") == 0 && file + 2 < argc) {
+				limits.memory = std::strtoull(argv[++file], nullptr, 10);
+			}
+			else if (strcmp(argv[file], "--memory-stats") == 0) {
+				memoryStats = true;
+			}
+			else {
+				break;
+			}
+		}
+
+		Evaluator e(argv[file]);
+		e.cache = cache;
+		e.parallel = parallel;
+		e.limits = limits;
+		e.measureMemory = memoryStats;
+
+		// reported when the run fails as well
+		struct Report
+		{
+			Evaluator &e;
+
+			~Report()
+			{
+				if (e.measureMemory && e.memory != nullptr) {
+					std::cout.flush();
+					std::cerr << "peak memory: " << e.memory->peak << " bytes" << std::endl;
+				}
+			}
+		} report{e};
 		e.evalAndPrint();
 		//std::cerr << program << std::endl;
 	}
@@ -25,10 +95,19 @@ int main(int argc, char** argv)
 	{
 		std::cerr << bs << std::endl;
 	}
+	catch (BadArity ba)
+	{
+		std::cerr << ba << std::endl;
+	}
 	catch (RuntimeError re)
 	{
 		std::cerr << re << std::endl;
 	}
+	catch (DaemonError de)
+	{
+		std::cerr << de << std::endl;
+		return 1;
+	}
 
 	return 0;
 }
\ No newline at end of file
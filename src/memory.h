@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+struct MemoryExceeded
+{
+	std::size_t limit;
+};
+
+/*
+ * The bytes held by the strings, arrays, maps, frames and globals of a
+ * single run. What is allocated on a thread while the run is current there
+ * is counted to it, and given back once freed, even when that happens after
+ * the run.
+ */
+struct Memory
+{
+	// zero stands for no limit
+	std::size_t limit;
+	std::atomic<std::size_t> used{0};
+	std::atomic<std::size_t> peak{0};
+
+	Memory(std::size_t limit) : limit(limit) {}
+
+	// the memory of the run on this thread, none when it is not counted
+	static std::shared_ptr<Memory> &current()
+	{
+		static thread_local std::shared_ptr<Memory> memory;
+		return memory;
+	}
+
+	void allocate(std::size_t bytes)
+	{
+		auto now = used += bytes;
+		if (limit != 0 && now > limit) {
+			used -= bytes;
+			throw MemoryExceeded{limit};
+		}
+		auto highest = peak.load();
+		while (now > highest && !peak.compare_exchange_weak(highest, now)) {}
+	}
+
+	void release(std::size_t bytes)
+	{
+		used -= bytes;
+	}
+
+	// makes the memory current on this thread until the end of the scope
+	struct Scope
+	{
+		std::shared_ptr<Memory> previous;
+
+		Scope(std::shared_ptr<Memory> memory) : previous(std::move(current()))
+		{
+			current() = std::move(memory);
+		}
+
+		~Scope()
+		{
+			current() = std::move(previous);
+		}
+	};
+};
+
+/*
+ * Bytes held by a single object, counted to the memory which was current
+ * when the object was created. A copy is a new object, it holds as many
+ * bytes again in the memory current at the time.
+ */
+struct Charge
+{
+	Charge() : memory(Memory::current()) {}
+
+	Charge(const Charge &other) : memory(Memory::current())
+	{
+		set(other.bytes);
+	}
+
+	Charge(Charge &&other) noexcept : memory(std::move(other.memory)), bytes(other.bytes)
+	{
+		other.bytes = 0;
+	}
+
+	Charge &operator=(Charge other) noexcept
+	{
+		std::swap(memory, other.memory);
+		std::swap(bytes, other.bytes);
+		return *this;
+	}
+
+	~Charge()
+	{
+		if (memory != nullptr) {
+			memory->release(bytes);
+		}
+	}
+
+	void set(std::size_t size)
+	{
+		if (memory == nullptr) {
+			return;
+		}
+		if (size > bytes) {
+			memory->allocate(size - bytes);
+		}
+		else {
+			memory->release(bytes - size);
+		}
+		bytes = size;
+	}
+
+private:
+	std::shared_ptr<Memory> memory;
+	std::size_t bytes = 0;
+};
\ No newline at end of file
@@ -0,0 +1,1208 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "scope.h"
+
+/*
+ * Source-to-source passes over an analyzed Toplevel. Every pass only relies on
+ * the scopes computed by the previous run of the Analyzer and leaves the
+ * scopes of new or moved code empty, so the tree has to be analyzed again
+ * after each of them. Identifiers introduced by the passes contain '$', which
+ * the Lexer never produces, so they cannot clash with names of the user.
+ */
+struct Optimizer
+{
+	Toplevel &toplevel;
+	StringTable &stringTable;
+
+	// maximal size (in AST nodes) of a function body that gets inlined
+	std::size_t inlineBudget = 40;
+	// inlining into a function stops once its body reaches this size
+	std::size_t growthLimit = 1000;
+
+	using Pass = void (Optimizer::*)();
+	std::vector<Pass> passes{&Optimizer::inlining, &Optimizer::loopInvariants, &Optimizer::commonSubexpressions,
+	                         &Optimizer::deadCode};
+
+	Optimizer(Toplevel &toplevel, StringTable &stringTable) : toplevel(toplevel), stringTable(stringTable) {}
+
+	void inlining()
+	{
+		for (auto &global : toplevel.globals) {
+			global.match([&](Func &f) {
+				auto callerSize = size(*f.body);
+				inlineCalls(*f.body, callerSize, true);
+				registerFunction(f);
+			});
+		}
+		flush();
+	}
+
+	/*
+	 * Moves pure expressions whose operands do not change inside of a loop in
+	 * front of it. Calls make every global variable loop-variant.
+	 */
+	void loopInvariants()
+	{
+		for (auto &global : toplevel.globals) {
+			global.match([&](Func &f) { loopInvariants(*f.body); });
+		}
+		flush();
+	}
+
+	/*
+	 * Evaluates a pure expression that occurs repeatedly in consecutive
+	 * statements of a block only once. Any call and any write to one of its
+	 * variables ends the range in which it can be reused.
+	 */
+	void commonSubexpressions()
+	{
+		for (auto &global : toplevel.globals) {
+			global.match([&](Func &f) { commonSubexpressions(*f.body); });
+		}
+		flush();
+	}
+
+	/*
+	 * Removes statements following a return, branches and loops whose
+	 * condition is a literal, unused locals with pure initializers and
+	 * functions that cannot be reached from the toplevel.
+	 */
+	void deadCode()
+	{
+		for (auto &global : toplevel.globals) {
+			global.match([&](Func &f) {
+				prune(*f.body, f);
+				unusedVariables(f);
+			});
+		}
+		unusedFunctions();
+		flush();
+	}
+
+private:
+	struct Inlinable
+	{
+		Func *func;
+		std::set<std::string> freeNames;
+	};
+
+	struct Renaming
+	{
+		std::vector<std::map<std::string, std::string>> scopes;
+		std::set<std::string> freeNames;
+		bool fresh;
+	};
+
+	std::map<std::string, Inlinable> inlinable;
+	std::vector<Identifier> fresh;
+	std::size_t counter = 0;
+
+	void flush()
+	{
+		for (auto &id : fresh) {
+			stringTable.add(id);
+		}
+		fresh.clear();
+	}
+
+	void registerFunction(Func &f)
+	{
+		if (calls(*f.body, f.name.token.text) || !lowerable(f.body->statements) || size(*f.body) > inlineBudget) {
+			return;
+		}
+
+		Renaming identity{{}, {}, false};
+		Identifier ret;
+		ret.token = Token(Token::Identifier, "ret", 0);
+		auto body = cloneBody(f, identity);
+		if (size(lower(body, ret, true)) > inlineBudget) {
+			return;
+		}
+		inlinable[f.name.token.text] = Inlinable{&f, identity.freeNames};
+	}
+
+	void inlineCalls(Block &b, std::size_t &callerSize, bool top)
+	{
+		if (b.scope == nullptr) {
+			return;
+		}
+		for (std::size_t i = 0; i < b.statements.size(); ) {
+			if (callerSize < growthLimit && inlineSite(b, i, callerSize, top)) {
+				continue;
+			}
+			b.statements[i]->match([&](If &s) {
+				inlineCalls(*s.body, callerSize, false);
+				if (s.elseBody != nullptr) {
+					inlineCalls(*s.elseBody, callerSize, false);
+				}
+			},
+			[&](While &w) { inlineCalls(*w.body, callerSize, false); },
+			[&](For &f) { inlineCalls(*f.body, callerSize, false); });
+			++i;
+		}
+	}
+
+	/*
+	 * Replaces the first call in statement i that can be moved in front of the
+	 * statement, i.e. everything evaluated before it is free of side effects and
+	 * only reads locals of the caller, by the lowered body of the callee.
+	 */
+	bool inlineSite(Block &b, std::size_t i, std::size_t &callerSize, bool top)
+	{
+		auto statement = b.statements[i];
+		Ptr<Expression> *slot = nullptr;
+		Call *whole = nullptr;
+		bool safe = true;
+
+		statement->match([&](Var &v) {
+			if (v.value != nullptr && !mentions(*v.value, v.name.token.text)) {
+				slot = find(v.value, safe, b.scope);
+			}
+		},
+		[&](If &s) { slot = find(s.condition, safe, b.scope); },
+		[&](For &f) {
+			slot = find(f.from, safe, b.scope);
+			if (slot == nullptr) {
+				slot = find(f.to, safe, b.scope);
+			}
+		},
+		[&](Return &r) { slot = find(r.returnValue, safe, b.scope); },
+		[&](Call &c) {
+			if (candidate(c, b.scope)) {
+				whole = &c;
+			} else {
+				slot = find(c.operands, false, safe, b.scope);
+			}
+		},
+		[&](Operator &o) { slot = find(o, safe, b.scope); });
+
+		if (slot == nullptr && whole == nullptr) {
+			return false;
+		}
+
+		Call &call = (whole != nullptr) ? *whole : (*slot)->get<Call>();
+		auto &callee = inlinable[call.function.token.text];
+		auto &f = *callee.func;
+
+		Renaming renaming{{{}}, {}, true};
+		std::vector<Ptr<Statement>> replacement;
+		for (std::size_t k = 0; k < f.parameters.size(); ++k) {
+			Var param;
+			param.name = f.parameters[k];
+			declare(param.name, renaming);
+			param.value = call.operands[k];
+			replacement.push_back(std::make_shared<Statement>(param));
+		}
+
+		Var result;
+		result.name = identifier("ret");
+		Identifier ret = result.name;
+		replacement.push_back(std::make_shared<Statement>(result));
+
+		std::vector<Ptr<Statement>> body;
+		for (auto &s : f.body->statements) {
+			body.push_back(clone(*s, renaming));
+		}
+		for (auto &s : lower(body, ret, true)) {
+			replacement.push_back(s);
+		}
+
+		if (whole != nullptr) {
+			if (top && i == b.statements.size() - 1) {
+				Return r;
+				r.returnValue = make_expr(ExprBase(Atom(ret)));
+				replacement.push_back(std::make_shared<Statement>(r));
+			}
+		} else {
+			*slot = make_expr(ExprBase(Atom(ret)));
+			replacement.push_back(statement);
+		}
+
+		callerSize += size(replacement);
+		b.statements.erase(b.statements.begin() + i);
+		b.statements.insert(b.statements.begin() + i, replacement.begin(), replacement.end());
+		return true;
+	}
+
+	Ptr<Expression> *find(Ptr<Expression> &slot, bool &safe, const Ptr<Scope> &scope)
+	{
+		Ptr<Expression> *found = nullptr;
+		slot->match([&](Operator &o) { found = find(o, safe, scope); },
+			[&](Call &c) {
+				if (safe && candidate(c, scope)) {
+					found = &slot;
+					return;
+				}
+				found = find(c.operands, false, safe, scope);
+				// the call itself might have side effects
+				safe = false;
+			},
+			[&](Atom &a) {
+				a.match([&](Identifier &i) { safe = safe && isLocal(i.token.text, scope); });
+			});
+		return found;
+	}
+
+	Ptr<Expression> *find(Operator &o, bool &safe, const Ptr<Scope> &scope)
+	{
+		auto category = o.token.category;
+		if (category == Token::Assign) {
+			// the target of an assignment is not read
+			Ptr<Expression> *found = nullptr;
+			for (std::size_t k = 1; k < o.operands.size() && found == nullptr; ++k) {
+				found = find(o.operands[k], safe, scope);
+			}
+			safe = false;
+			return found;
+		}
+		return find(o.operands, category == Token::And || category == Token::Or, safe, scope);
+	}
+
+	Ptr<Expression> *find(std::vector<Ptr<Expression>> &operands, bool conditional, bool &safe, const Ptr<Scope> &scope)
+	{
+		for (std::size_t k = 0; k < operands.size(); ++k) {
+			if (conditional && k > 0) {
+				safe = false;
+			}
+			if (auto found = find(operands[k], safe, scope)) {
+				return found;
+			}
+		}
+		return nullptr;
+	}
+
+	bool candidate(Call &c, const Ptr<Scope> &scope)
+	{
+		if (c.isSysCall) {
+			return false;
+		}
+		auto callee = inlinable.find(c.function.token.text);
+		if (callee == inlinable.end() || callee->second.func->parameters.size() != c.operands.size()) {
+			return false;
+		}
+		for (auto &operand : c.operands) {
+			if (writes(*operand)) {
+				return false;
+			}
+		}
+		for (auto &name : callee->second.freeNames) {
+			if (isLocal(name, scope)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool isLocal(const std::string &name, const Ptr<Scope> &scope)
+	{
+		if (name.find('$') != std::string::npos) {
+			return true;
+		}
+		Identifier id;
+		id.token.text = name;
+		if (!stringTable.exists(id) || !scope->exists(stringTable.get(id))) {
+			return false;
+		}
+		return !scope->getSymbol(stringTable.get(id)).global;
+	}
+
+	Identifier identifier(std::string name)
+	{
+		Identifier id;
+		id.token = Token(Token::Identifier, name + "$" + std::to_string(counter++), 0);
+		fresh.push_back(id);
+		return id;
+	}
+
+	void declare(Identifier &id, Renaming &renaming)
+	{
+		auto name = id.token.text;
+		if (renaming.fresh) {
+			id = identifier(name);
+		}
+		renaming.scopes.back()[name] = id.token.text;
+	}
+
+	void rename(Identifier &id, Renaming &renaming)
+	{
+		for (auto scope = renaming.scopes.rbegin(); scope != renaming.scopes.rend(); ++scope) {
+			auto found = scope->find(id.token.text);
+			if (found != scope->end()) {
+				id.token.text = found->second;
+				return;
+			}
+		}
+		renaming.freeNames.insert(id.token.text);
+	}
+
+	std::vector<Ptr<Statement>> cloneBody(Func &f, Renaming &renaming)
+	{
+		renaming.scopes.emplace_back();
+		for (auto param : f.parameters) {
+			declare(param, renaming);
+		}
+		std::vector<Ptr<Statement>> body;
+		for (auto &s : f.body->statements) {
+			body.push_back(clone(*s, renaming));
+		}
+		renaming.scopes.pop_back();
+		return body;
+	}
+
+	Ptr<Expression> clone(Expression &ex, Renaming &renaming)
+	{
+		Ptr<Expression> result;
+		ex.match([&](Operator &o) {
+			Operator copy = o;
+			copy.operands = clone(o.operands, renaming);
+			result = make_expr(copy);
+		},
+		[&](Call &c) {
+			Call copy = c;
+			copy.operands = clone(c.operands, renaming);
+			result = make_expr(copy);
+		},
+		[&](Atom &a) {
+			Atom copy = a;
+			copy.match([&](Identifier &i) { rename(i, renaming); });
+			result = make_expr(ExprBase(copy));
+		});
+		return result;
+	}
+
+	std::vector<Ptr<Expression>> clone(std::vector<Ptr<Expression>> &operands, Renaming &renaming)
+	{
+		std::vector<Ptr<Expression>> copy;
+		for (auto &operand : operands) {
+			copy.push_back(clone(*operand, renaming));
+		}
+		return copy;
+	}
+
+	Ptr<Block> clone(Block &b, Renaming &renaming, Identifier *variable = nullptr)
+	{
+		auto copy = std::make_shared<Block>();
+		renaming.scopes.emplace_back();
+		if (variable != nullptr) {
+			declare(*variable, renaming);
+		}
+		for (auto &s : b.statements) {
+			copy->statements.push_back(clone(*s, renaming));
+		}
+		renaming.scopes.pop_back();
+		return copy;
+	}
+
+	Ptr<Statement> clone(Statement &s, Renaming &renaming)
+	{
+		Ptr<Statement> result;
+		s.match([&](Var &v) {
+			Var copy = v;
+			declare(copy.name, renaming);
+			if (v.value != nullptr) {
+				copy.value = clone(*v.value, renaming);
+			}
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](If &i) {
+			If copy;
+			copy.condition = clone(*i.condition, renaming);
+			copy.body = clone(*i.body, renaming);
+			if (i.elseBody != nullptr) {
+				copy.elseBody = clone(*i.elseBody, renaming);
+			}
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](While &w) {
+			While copy;
+			copy.condition = clone(*w.condition, renaming);
+			copy.body = clone(*w.body, renaming);
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](For &f) {
+			For copy = f;
+			copy.from = clone(*f.from, renaming);
+			copy.to = clone(*f.to, renaming);
+			copy.body = clone(*f.body, renaming, &copy.variable);
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](Return &r) {
+			Return copy;
+			copy.returnValue = clone(*r.returnValue, renaming);
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](Call &c) {
+			Call copy = c;
+			copy.operands = clone(c.operands, renaming);
+			result = std::make_shared<Statement>(copy);
+		},
+		[&](Operator &o) {
+			Operator copy = o;
+			copy.operands = clone(o.operands, renaming);
+			result = std::make_shared<Statement>(copy);
+		});
+		return result;
+	}
+
+	/*
+	 * Rewrites a cloned function body so that it stores its result into `ret`
+	 * and falls through instead of returning. Statements following an `if`
+	 * that may return are moved into the branches which do not always return.
+	 */
+	std::vector<Ptr<Statement>> lower(std::vector<Ptr<Statement>> statements, Identifier ret, bool tail)
+	{
+		std::vector<Ptr<Statement>> result;
+		for (std::size_t k = 0; k < statements.size(); ++k) {
+			auto statement = statements[k];
+			bool last = k == statements.size() - 1;
+
+			if (statement->is<Return>()) {
+				result.push_back(assign(ret, statement->get<Return>().returnValue));
+				return result;
+			}
+			if (tail && last && statement->is<Call>() && !statement->get<Call>().isSysCall &&
+			    statement->get<Call>().builtin == Builtin::None) {
+				// the value of a call in tail position is the value of the function
+				result.push_back(assign(ret, make_expr(ExprBase(statement->get<Call>()))));
+				return result;
+			}
+			if (statement->is<If>() && returns(*statement)) {
+				auto &i = statement->get<If>();
+				std::vector<Ptr<Statement>> rest(statements.begin() + k + 1, statements.end());
+
+				i.body->statements = lower(i.body->statements, rest, ret, tail);
+				if (i.elseBody == nullptr && !rest.empty()) {
+					i.elseBody = std::make_shared<Block>();
+				}
+				if (i.elseBody != nullptr) {
+					i.elseBody->statements = lower(i.elseBody->statements, rest, ret, tail);
+				}
+				result.push_back(statement);
+				return result;
+			}
+			result.push_back(statement);
+		}
+		return result;
+	}
+
+	std::vector<Ptr<Statement>> lower(std::vector<Ptr<Statement>> branch, std::vector<Ptr<Statement>> &rest, Identifier ret, bool tail)
+	{
+		if (alwaysReturns(branch) || rest.empty()) {
+			return lower(branch, ret, false);
+		}
+		Renaming identity{{{}}, {}, false};
+		for (auto &s : rest) {
+			branch.push_back(clone(*s, identity));
+		}
+		return lower(branch, ret, tail);
+	}
+
+	Ptr<Statement> assign(Identifier target, Ptr<Expression> value)
+	{
+		Operator o;
+		o.token = Token(Token::Assign, "=", target.token.line);
+		o.operands.push_back(make_expr(ExprBase(Atom(target))));
+		o.operands.push_back(value);
+		return std::make_shared<Statement>(o);
+	}
+
+	bool alwaysReturns(std::vector<Ptr<Statement>> &statements)
+	{
+		for (auto &s : statements) {
+			if (alwaysReturns(*s)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool alwaysReturns(Statement &s)
+	{
+		if (s.is<Return>()) {
+			return true;
+		}
+		if (s.is<If>()) {
+			auto &i = s.get<If>();
+			return i.elseBody != nullptr && alwaysReturns(i.body->statements) && alwaysReturns(i.elseBody->statements);
+		}
+		return false;
+	}
+
+	// only returns outside of loops can be turned into assignments
+	bool lowerable(std::vector<Ptr<Statement>> &statements)
+	{
+		for (auto &s : statements) {
+			bool ok = true;
+			s->match([&](If &i) {
+				ok = lowerable(i.body->statements) && (i.elseBody == nullptr || lowerable(i.elseBody->statements));
+			},
+			[&](While &w) { ok = !returns(*w.body); },
+			[&](For &f) { ok = !returns(*f.body); });
+			if (!ok) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool returns(Block &b)
+	{
+		for (auto &s : b.statements) {
+			if (returns(*s)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool returns(Statement &s)
+	{
+		bool result = false;
+		s.match([&](If &i) { result = returns(*i.body) || (i.elseBody != nullptr && returns(*i.elseBody)); },
+			[&](While &w) { result = returns(*w.body); },
+			[&](For &f) { result = returns(*f.body); },
+			[&](Return &) { result = true; });
+		return result;
+	}
+
+	bool calls(Block &b, const std::string &name)
+	{
+		bool found = false;
+		visit(b, [&](Expression &ex) {
+			ex.match([&](Call &c) { found = found || c.function.token.text == name; });
+		});
+		return found;
+	}
+
+	// an expression writes if it assigns or reads into a variable
+	bool writes(Expression &ex)
+	{
+		bool found = false;
+		visit(ex, [&](Expression &e) {
+			e.match([&](Operator &o) { found = found || o.token.category == Token::Assign; },
+				[&](Call &c) { found = found || (c.isSysCall && c.function.token.text == "Read"); });
+		});
+		return found;
+	}
+
+	bool mentions(Expression &ex, const std::string &name)
+	{
+		bool found = false;
+		visit(ex, [&](Expression &e) {
+			e.match([&](Atom &a) {
+				a.match([&](Identifier &i) { found = found || i.token.text == name; });
+			});
+		});
+		return found;
+	}
+
+	template<typename F>
+	void visit(Expression &ex, F f)
+	{
+		f(ex);
+		ex.match([&](Operator &o) { visit(o.operands, f); },
+			[&](Call &c) { visit(c.operands, f); });
+	}
+
+	template<typename F>
+	void visit(std::vector<Ptr<Expression>> &operands, F f)
+	{
+		for (auto &operand : operands) {
+			visit(*operand, f);
+		}
+	}
+
+	template<typename F>
+	void visit(Block &b, F f)
+	{
+		for (auto &s : b.statements) {
+			s->match([&](Var &v) {
+				if (v.value != nullptr) {
+					visit(*v.value, f);
+				}
+			},
+			[&](If &i) {
+				visit(*i.condition, f);
+				visit(*i.body, f);
+				if (i.elseBody != nullptr) {
+					visit(*i.elseBody, f);
+				}
+			},
+			[&](While &w) {
+				visit(*w.condition, f);
+				visit(*w.body, f);
+			},
+			[&](For &fr) {
+				visit(*fr.from, f);
+				visit(*fr.to, f);
+				visit(*fr.body, f);
+			},
+			[&](Return &r) { visit(*r.returnValue, f); },
+			[&](Call &c) {
+				Expression ex{ExprBase(c)};
+				f(ex);
+				visit(c.operands, f);
+			},
+			[&](Operator &o) {
+				Expression ex{ExprBase(o)};
+				f(ex);
+				visit(o.operands, f);
+			});
+		}
+	}
+
+	void prune(Block &b, Func &f)
+	{
+		for (std::size_t i = 0; i < b.statements.size(); ) {
+			auto statement = b.statements[i];
+			blocks(*statement, [&](Block &nested) { prune(nested, f); });
+
+			Literal condition;
+			if (statement->is<If>() && literal(*statement->get<If>().condition, condition)) {
+				auto &s = statement->get<If>();
+				auto branch = truth(condition) ? s.body : s.elseBody;
+				bool splice = branch != nullptr && splicable(*branch, f);
+				b.statements.erase(b.statements.begin() + i);
+
+				if (branch == nullptr) {
+					continue;
+				}
+				if (splice) {
+					b.statements.insert(b.statements.begin() + i, branch->statements.begin(), branch->statements.end());
+					continue;
+				}
+				// the branch declares a variable which must stay in its own scope
+				If taken;
+				taken.condition = make_expr(ExprBase(Atom(Literal(1))));
+				taken.body = branch;
+				b.statements.insert(b.statements.begin() + i, std::make_shared<Statement>(taken));
+				++i;
+				continue;
+			}
+			if (statement->is<While>() && literal(*statement->get<While>().condition, condition) && !truth(condition)) {
+				b.statements.erase(b.statements.begin() + i);
+				continue;
+			}
+			if (alwaysReturns(*statement)) {
+				b.statements.erase(b.statements.begin() + i + 1, b.statements.end());
+			}
+			++i;
+		}
+	}
+
+	bool literal(Expression &ex, Literal &value)
+	{
+		bool result = false;
+		ex.match([&](Atom &a) {
+			a.match([&](Literal &l) {
+				value = l;
+				result = true;
+			});
+		});
+		return result;
+	}
+
+	// the same conversion the Evaluator uses for conditions
+	bool truth(Literal &l)
+	{
+		bool result = false;
+		l.match([&](String &s) { result = !s.empty(); },
+			[&](Integer &i) { result = !i.isZero(); });
+		return result;
+	}
+
+	// statements of a branch can be moved into the enclosing block if none of its variables is named anywhere else
+	bool splicable(Block &branch, Func &f)
+	{
+		for (auto &s : branch.statements) {
+			if (!s->is<Var>()) {
+				continue;
+			}
+			auto &name = s->get<Var>().name.token.text;
+			if (occurrences(*f.body, name) != occurrences(branch, name)) {
+				return false;
+			}
+			for (auto &param : f.parameters) {
+				if (param.token.text == name) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	std::size_t occurrences(Block &b, const std::string &name)
+	{
+		std::size_t result = 0;
+		visit(b, [&](Expression &ex) {
+			ex.match([&](Atom &a) {
+				a.match([&](Identifier &i) { result += i.token.text == name; });
+			});
+		});
+		declarations(b, [&](Identifier &i) { result += i.token.text == name; });
+		return result;
+	}
+
+	template<typename F>
+	void declarations(Block &b, F f)
+	{
+		for (auto &s : b.statements) {
+			s->match([&](Var &v) { f(v.name); },
+				[&](For &fr) { f(fr.variable); });
+			blocks(*s, [&](Block &nested) { declarations(nested, f); });
+		}
+	}
+
+	void unusedVariables(Func &f)
+	{
+		bool changed = true;
+		while (changed) {
+			std::map<std::string, std::size_t> uses;
+			visit(*f.body, [&](Expression &ex) {
+				ex.match([&](Atom &a) {
+					a.match([&](Identifier &i) { ++uses[i.token.text]; });
+				});
+			});
+			changed = removeVariables(*f.body, uses);
+		}
+	}
+
+	bool removeVariables(Block &b, std::map<std::string, std::size_t> &uses)
+	{
+		bool changed = false;
+		for (std::size_t i = 0; i < b.statements.size(); ) {
+			auto &s = *b.statements[i];
+			if (s.is<Var>() && uses[s.get<Var>().name.token.text] == 0 &&
+			    (s.get<Var>().value == nullptr || pure(*s.get<Var>().value))) {
+				b.statements.erase(b.statements.begin() + i);
+				changed = true;
+				continue;
+			}
+			blocks(s, [&](Block &nested) { changed = removeVariables(nested, uses) || changed; });
+			++i;
+		}
+		return changed;
+	}
+
+	static bool named(Expression &ex)
+	{
+		return ex.is<Atom>() && ex.get<Atom>().is<Literal>() && ex.get<Atom>().get<Literal>().is<String>();
+	}
+
+	void unusedFunctions()
+	{
+		std::map<std::string, Func *> functions;
+		std::vector<std::string> work;
+		// a name computed at run time may be any function
+		bool computed = false;
+		auto called = [&](Expression &ex) {
+			ex.match([&](Call &c) {
+				if (!c.isSysCall) {
+					work.push_back(c.function.token.text);
+				}
+				if ((c.builtin == Builtin::Spawn || c.builtin == Builtin::ForkMap) && !named(*c.operands[0])) {
+					computed = true;
+				}
+			},
+			[&](Atom &a) {
+				// a function can be named by a string, as in Spawn
+				a.match([&](Literal &l) {
+					if (l.is<String>()) {
+						work.push_back(l.get<String>().str());
+					}
+				});
+			});
+		};
+
+		for (auto &global : toplevel.globals) {
+			global.match([&](Func &f) { functions[f.name.token.text] = &f; },
+				[&](Var &v) {
+					if (v.value != nullptr) {
+						visit(*v.value, called);
+					}
+				},
+				[&](Call &c) {
+					Expression ex{ExprBase(c)};
+					visit(ex, called);
+				});
+		}
+
+		std::set<std::string> reachable;
+		while (!work.empty()) {
+			auto name = work.back();
+			work.pop_back();
+			if (reachable.insert(name).second && functions.count(name) > 0) {
+				visit(*functions[name]->body, called);
+			}
+		}
+		if (computed) {
+			return;
+		}
+
+		auto &globals = toplevel.globals;
+		globals.erase(std::remove_if(globals.begin(), globals.end(), [&](Global &g) {
+			return g.is<Func>() && reachable.count(g.get<Func>().name.token.text) == 0;
+		}), globals.end());
+	}
+
+	void loopInvariants(Block &b)
+	{
+		for (std::size_t i = 0; i < b.statements.size(); ++i) {
+			auto statement = b.statements[i];
+			if (statement->is<While>() || statement->is<For>()) {
+				i += hoist(b, i);
+			}
+			blocks(*statement, [&](Block &nested) { loopInvariants(nested); });
+		}
+	}
+
+	// returns the number of statements inserted in front of the loop
+	std::size_t hoist(Block &b, std::size_t i)
+	{
+		auto loop = b.statements[i];
+		std::set<std::string> written;
+		bool calls = false;
+		effects(*loop, written, calls);
+
+		std::vector<std::string> keys;
+		std::map<std::string, std::vector<Ptr<Expression> *>> invariants;
+		std::function<void(Ptr<Expression> &)> collect = [&](Ptr<Expression> &slot) {
+			if (slot->is<Operator>() && invariant(*slot, written, calls, b.scope)) {
+				auto key = print(*slot);
+				if (invariants[key].empty()) {
+					keys.push_back(key);
+				}
+				invariants[key].push_back(&slot);
+				return;
+			}
+			slot->match([&](Operator &o) {
+				for (auto &operand : o.operands) {
+					collect(operand);
+				}
+			},
+			[&](Call &c) {
+				for (auto &operand : c.operands) {
+					collect(operand);
+				}
+			});
+		};
+
+		loop->match([&](While &w) {
+			collect(w.condition);
+			expressions(*w.body, collect);
+		},
+		[&](For &f) { expressions(*f.body, collect); });
+
+		std::vector<Ptr<Statement>> hoisted;
+		for (auto &key : keys) {
+			auto &slots = invariants[key];
+			Var v;
+			v.name = identifier("inv");
+			v.value = *slots.front();
+			for (auto slot : slots) {
+				*slot = make_expr(ExprBase(Atom(v.name)));
+			}
+			hoisted.push_back(std::make_shared<Statement>(v));
+		}
+		b.statements.insert(b.statements.begin() + i, hoisted.begin(), hoisted.end());
+		return hoisted.size();
+	}
+
+	bool invariant(Expression &ex, std::set<std::string> &written, bool calls, const Ptr<Scope> &scope)
+	{
+		bool result = false;
+		ex.match([&](Operator &o) {
+			auto category = o.token.category;
+			if (category == Token::Assign || o.operands.empty()) {
+				return;
+			}
+			result = true;
+			for (std::size_t k = 0; k < o.operands.size(); ++k) {
+				// the expression is evaluated even if the loop is not, so it must not trap
+				if (k > 0 && (category == Token::Slash || category == Token::Modulo) && !nonzero(*o.operands[k])) {
+					result = false;
+				}
+				result = result && invariant(*o.operands[k], written, calls, scope);
+			}
+		},
+		[&](Atom &a) {
+			result = true;
+			a.match([&](Identifier &i) {
+				auto &name = i.token.text;
+				result = written.count(name) == 0 && (!calls || isLocal(name, scope));
+			});
+		});
+		return result;
+	}
+
+	bool nonzero(Expression &ex)
+	{
+		bool result = false;
+		ex.match([&](Atom &a) {
+			a.match([&](Literal &l) {
+				l.match([&](Integer &i) { result = !i.isZero(); });
+			});
+		});
+		return result;
+	}
+
+	void commonSubexpressions(Block &b)
+	{
+		for (std::size_t i = 0; i < b.statements.size(); ) {
+			if (reuse(b, i)) {
+				continue;
+			}
+			blocks(*b.statements[i], [&](Block &nested) { commonSubexpressions(nested); });
+			++i;
+		}
+	}
+
+	/*
+	 * Looks for a pure expression evaluated by statement i which is evaluated
+	 * again before it could change. If there is one, it is stored into a new
+	 * variable declared in front of statement i.
+	 */
+	bool reuse(Block &b, std::size_t i)
+	{
+		if (!clean(*b.statements[i])) {
+			return false;
+		}
+
+		std::vector<Ptr<Expression> *> candidates;
+		std::function<void(Ptr<Expression> &)> collect = [&](Ptr<Expression> &slot) {
+			slot->match([&](Operator &o) {
+				if (o.token.category != Token::Assign && pure(*slot)) {
+					candidates.push_back(&slot);
+				}
+				// later operands of && and || need not be evaluated at all
+				bool conditional = o.token.category == Token::And || o.token.category == Token::Or;
+				for (std::size_t k = 0; k < o.operands.size() && (k == 0 || !conditional); ++k) {
+					collect(o.operands[k]);
+				}
+			});
+		};
+		own(*b.statements[i], collect);
+
+		for (auto candidate : candidates) {
+			auto key = print(**candidate);
+			auto names = variables(**candidate);
+			bool calls = false;
+			std::vector<Ptr<Expression> *> occurrences;
+			std::function<void(Ptr<Expression> &)> match = [&](Ptr<Expression> &slot) {
+				if (print(*slot) == key) {
+					occurrences.push_back(&slot);
+					return;
+				}
+				slot->match([&](Operator &o) {
+					for (auto &operand : o.operands) {
+						match(operand);
+					}
+				});
+			};
+
+			for (std::size_t j = i; j < b.statements.size(); ++j) {
+				auto &statement = *b.statements[j];
+				if (clean(statement)) {
+					own(statement, match);
+				}
+
+				std::set<std::string> written;
+				effects(statement, written, calls);
+				bool killed = calls;
+				for (auto &name : names) {
+					killed = killed || written.count(name) > 0;
+				}
+				if (killed) {
+					break;
+				}
+			}
+
+			if (occurrences.size() > 1) {
+				Var v;
+				v.name = identifier("cse");
+				v.value = *occurrences.front();
+				for (auto slot : occurrences) {
+					*slot = make_expr(ExprBase(Atom(v.name)));
+				}
+				b.statements.insert(b.statements.begin() + i, std::make_shared<Statement>(v));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool pure(Expression &ex)
+	{
+		bool result = true;
+		visit(ex, [&](Expression &e) {
+			e.match([&](Operator &o) { result = result && o.token.category != Token::Assign; },
+				[&](Call &) { result = false; });
+		});
+		return result;
+	}
+
+	// a statement is clean if evaluating its own expressions has no side effects
+	bool clean(Statement &s)
+	{
+		bool result = true;
+		own(s, [&](Ptr<Expression> &slot) { result = result && pure(*slot); });
+		return result;
+	}
+
+	std::string print(Expression &ex)
+	{
+		std::stringstream s;
+		s << ex;
+		return s.str();
+	}
+
+	// names of all variables a statement may write and whether it calls anything
+	void effects(Statement &s, std::set<std::string> &written, bool &calls)
+	{
+		auto expression = [&](Expression &ex) {
+			visit(ex, [&](Expression &e) {
+				e.match([&](Operator &o) { effects(o, written); },
+					[&](Call &c) { effects(c, written, calls); });
+			});
+		};
+
+		s.match([&](Var &v) { written.insert(v.name.token.text); },
+			[&](While &w) { expression(*w.condition); },
+			[&](For &f) { written.insert(f.variable.token.text); },
+			[&](Call &c) { effects(c, written, calls); },
+			[&](Operator &o) { effects(o, written); });
+		own(s, [&](Ptr<Expression> &slot) { expression(*slot); });
+		blocks(s, [&](Block &nested) {
+			for (auto &statement : nested.statements) {
+				effects(*statement, written, calls);
+			}
+		});
+	}
+
+	void effects(Operator &o, std::set<std::string> &written)
+	{
+		if (o.token.category == Token::Assign && !o.operands.empty()) {
+			target(*o.operands.front(), written);
+		}
+	}
+
+	void effects(Call &c, std::set<std::string> &written, bool &calls)
+	{
+		calls = true;
+		if (c.function.token.text == "Read" && !c.operands.empty()) {
+			target(*c.operands.front(), written);
+		}
+	}
+
+	void target(Expression &ex, std::set<std::string> &written)
+	{
+		ex.match([&](Atom &a) {
+			a.match([&](Identifier &i) { written.insert(i.token.text); });
+		});
+	}
+
+	std::set<std::string> variables(Expression &ex)
+	{
+		std::set<std::string> names;
+		visit(ex, [&](Expression &e) { target(e, names); });
+		return names;
+	}
+
+	// expressions evaluated by the statement itself, outside of nested blocks
+	template<typename F>
+	void own(Statement &s, F f)
+	{
+		s.match([&](Var &v) {
+			if (v.value != nullptr) {
+				f(v.value);
+			}
+		},
+		[&](If &i) { f(i.condition); },
+		[&](For &fr) {
+			f(fr.from);
+			f(fr.to);
+		},
+		[&](Return &r) { f(r.returnValue); },
+		[&](Call &c) {
+			for (auto &operand : c.operands) {
+				f(operand);
+			}
+		},
+		[&](Operator &o) {
+			// the target of an assignment is not evaluated
+			for (std::size_t k = (o.token.category == Token::Assign) ? 1 : 0; k < o.operands.size(); ++k) {
+				f(o.operands[k]);
+			}
+		});
+	}
+
+	template<typename F>
+	void blocks(Statement &s, F f)
+	{
+		s.match([&](If &i) {
+			f(*i.body);
+			if (i.elseBody != nullptr) {
+				f(*i.elseBody);
+			}
+		},
+		[&](While &w) { f(*w.body); },
+		[&](For &fr) { f(*fr.body); });
+	}
+
+	// all expressions of a block including conditions of nested loops
+	template<typename F>
+	void expressions(Block &b, F f)
+	{
+		for (auto &s : b.statements) {
+			own(*s, f);
+			s->match([&](While &w) { f(w.condition); });
+			blocks(*s, [&](Block &nested) { expressions(nested, f); });
+		}
+	}
+
+	std::size_t size(Expression &ex)
+	{
+		std::size_t result = 0;
+		visit(ex, [&](Expression &) { ++result; });
+		return result;
+	}
+
+	std::size_t size(const std::vector<Ptr<Statement>> &statements)
+	{
+		std::size_t result = 0;
+		for (auto &s : statements) {
+			++result;
+			s->match([&](Var &v) { result += (v.value != nullptr) ? size(*v.value) : 0; },
+				[&](If &i) {
+					result += size(*i.condition) + size(*i.body);
+					result += (i.elseBody != nullptr) ? size(*i.elseBody) : 0;
+				},
+				[&](While &w) { result += size(*w.condition) + size(*w.body); },
+				[&](For &f) { result += size(*f.from) + size(*f.to) + size(*f.body); },
+				[&](Return &r) { result += size(*r.returnValue); },
+				[&](Call &c) {
+					for (auto &operand : c.operands) {
+						result += size(*operand);
+					}
+				},
+				[&](Operator &o) {
+					for (auto &operand : o.operands) {
+						result += size(*operand);
+					}
+				});
+		}
+		return result;
+	}
+
+	std::size_t size(Block &b)
+	{
+		return size(b.statements);
+	}
+};
@@ -1,7 +1,10 @@
 #pragma once
+#include <algorithm>
 #include <string>
+#include <vector>
 #include "ast.h"
 #include "lexer.h"
+#include "scheduler.h"
 #include "scope.h"
 
 struct BadParse
@@ -21,11 +24,15 @@ struct Parser
 	Lexer lexer;
 	Token token;
 	StringTable stringTable;
+	// threads which parse a large source, see chunked
+	std::size_t workers = 1;
 
 	Parser(const char *file) : lexer(file), token(Token::Eof, "", 0) {}
 
 	Parser(std::string file) : Parser(file.c_str()) {}
 
+	Parser(Source source) : lexer(std::move(source)), token(Token::Eof, "", 0) {}
+
 	void shift()
 	{
 		token = lexer.next();
@@ -38,6 +45,9 @@ struct Parser
 
 	Toplevel toplevel()
 	{
+		if (workers > 1 && lexer.source.size() >= 2 * chunkSize) {
+			return chunked();
+		}
 		Toplevel result;
 		while (true)
 		{
@@ -151,9 +161,9 @@ struct Parser
 			return Expression(token.text);
 		}
 		if (token.category == Token::NumericLit) {
-			return Expression(std::stoi(token.text));
+			return Expression(Integer::parse(token.text));
 		} 
-		if (lexer.isOperator(token.text)) {
+		if (token.isOperator()) {
 			return Expression(oper());
 		}
 		if (token.category == Token::Identifier) {
@@ -168,7 +178,7 @@ struct Parser
 
 	Operator oper()
 	{
-		if (!lexer.isOperator(token.text)) {
+		if (!token.isOperator()) {
 			fail("operator");
 		}
 		Operator op;
@@ -266,20 +276,20 @@ struct Parser
 		else if (token.category == Token::While) {
 			st = whileStatement();
 		}
-		else if (token.category == Token::For) {
+		else if (token.category == Token::For || token.category == Token::PFor) {
 			st = forStatement();
 		}
 		else if (token.category == Token::Return) {
 			st = returnStatement();
 		}
-		else if (lexer.isOperator(token.text)) {
+		else if (token.isOperator()) {
 			st = oper();
 		}
 		else if (isFunctionCall()) {
 			st = call();
 		}
 		else {
-			fail("var, if, while, for, return, operator or function call");
+			fail("var, if, while, for, pfor, return, operator or function call");
 		}
 		return st;
 	}
@@ -338,9 +348,11 @@ struct Parser
 
 	For forStatement()
 	{
-		if (token.category != Token::For) {
-			fail("for");
+		if (token.category != Token::For && token.category != Token::PFor) {
+			fail("for or pfor");
 		}
+		For f;
+		f.parallel = token.category == Token::PFor;
 		shift();
 		if (token.category != Token::ParentOpen) {
 			fail("(");
@@ -351,7 +363,6 @@ struct Parser
 		}
 		shift();
 		
-		For f;
 		f.variable = identifier();
 		if (!islower(f.variable.token.text[0])) {
 			fail("first letter to be lowercase");
@@ -402,6 +413,75 @@ struct Parser
 	}
 
 protected:
+	// the least a chunk parsed by a thread of its own takes
+	static const std::size_t chunkSize = 64 << 10;
+
+	/*
+	 * The source is cut into chunks at the boundaries of globals found by
+	 * the lexer, every worker parses chunks with a parser of its own. Their
+	 * globals are put together in the order of the chunks and so are their
+	 * identifiers, which are only numbered once the whole table is known.
+	 *
+	 * The chunks parse just like the whole source, except that a var at the
+	 * end of a chunk does not see a var which follows it; errors are found
+	 * once more in the whole source, so they are reported as they would be.
+	 */
+	Toplevel chunked()
+	{
+		auto boundaries = lexer.boundaries();
+		auto &source = lexer.source;
+		auto size = source.size() / (4 * workers);
+		if (size < chunkSize) {
+			size = chunkSize;
+		}
+		std::vector<Lexer::Boundary> starts{Lexer::Boundary{0, 1}};
+		for (auto &boundary : boundaries) {
+			if (boundary.position - starts.back().position >= size) {
+				starts.push_back(boundary);
+			}
+		}
+
+		std::vector<std::unique_ptr<Parser>> parsers(starts.size());
+		std::vector<Toplevel> parts(starts.size());
+		try {
+			Scheduler(std::min(workers, starts.size())).run(starts.size(), [&](std::size_t, std::int64_t i) {
+				auto end = (i + 1 < static_cast<std::int64_t>(starts.size())) ? starts[i + 1].position : source.size();
+				parsers[i].reset(new Parser(Source{source.substr(starts[i].position, end - starts[i].position)}));
+				parsers[i]->lexer.line = starts[i].line;
+				parts[i] = parsers[i]->toplevel();
+			});
+		}
+		catch (BadParse) {
+			return sequential();
+		}
+
+		for (std::size_t i = 1; i < parts.size(); i++) {
+			auto &last = parts[i - 1].globals;
+			if (source.compare(starts[i].position, 3, "var") == 0 && !last.empty() && last.back().is<Var>() &&
+			    last.back().get<Var>().value == nullptr) {
+				return sequential();
+			}
+		}
+
+		Toplevel result;
+		for (std::size_t i = 0; i < parts.size(); i++) {
+			auto &globals = parts[i].globals;
+			result.globals.insert(result.globals.end(), globals.begin(), globals.end());
+			auto &names = parsers[i]->stringTable.stringTable;
+			stringTable.stringTable.insert(names.begin(), names.end());
+		}
+		return result;
+	}
+
+	Toplevel sequential()
+	{
+		auto all = workers;
+		workers = 1;
+		auto result = toplevel();
+		workers = all;
+		return result;
+	}
+
 	bool isFunctionCall()
 	{
 		return token.category == Token::Identifier && isupper(token.text[0]);
@@ -409,7 +489,7 @@ protected:
 
 	Ptr<Expression> expressionOperCheck()
 	{
-		if (lexer.isOperator(token.text) && token.category != Token::StringLit) {
+		if (token.isOperator()) {
 			fail("( before operator");
 		}
 		return expression();
@@ -0,0 +1,164 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Skips runs of whitespace, identifier characters and plain characters of
+ * string literals, each function returns the position of the first byte
+ * which does not belong to the run. The bytes are classified a block of
+ * 32 (AVX2) or 16 (SSE2) at a time as long as a whole block is left, the
+ * rest one by one; without either instruction set all of them one by one.
+ */
+namespace scan {
+
+inline bool space(unsigned char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool word(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// a string literal ends at a quote, a backslash may start an escape
+inline bool plain(unsigned char c)
+{
+	return c != '"' && c != '\\';
+}
+
+#if defined(__AVX2__)
+struct Vector
+{
+	using Block = __m256i;
+	static const std::size_t width = 32;
+	static const std::uint32_t all = 0xffffffffu;
+
+	static Block load(const char *at) { return _mm256_loadu_si256(reinterpret_cast<const Block *>(at)); }
+	static Block splat(char c) { return _mm256_set1_epi8(c); }
+	static Block equal(Block lhs, Block rhs) { return _mm256_cmpeq_epi8(lhs, rhs); }
+	static Block either(Block lhs, Block rhs) { return _mm256_or_si256(lhs, rhs); }
+	static Block minus(Block lhs, Block rhs) { return _mm256_sub_epi8(lhs, rhs); }
+	static Block least(Block lhs, Block rhs) { return _mm256_min_epu8(lhs, rhs); }
+	static std::uint32_t mask(Block block) { return static_cast<std::uint32_t>(_mm256_movemask_epi8(block)); }
+};
+#elif defined(__SSE2__)
+struct Vector
+{
+	using Block = __m128i;
+	static const std::size_t width = 16;
+	static const std::uint32_t all = 0xffffu;
+
+	static Block load(const char *at) { return _mm_loadu_si128(reinterpret_cast<const Block *>(at)); }
+	static Block splat(char c) { return _mm_set1_epi8(c); }
+	static Block equal(Block lhs, Block rhs) { return _mm_cmpeq_epi8(lhs, rhs); }
+	static Block either(Block lhs, Block rhs) { return _mm_or_si128(lhs, rhs); }
+	static Block minus(Block lhs, Block rhs) { return _mm_sub_epi8(lhs, rhs); }
+	static Block least(Block lhs, Block rhs) { return _mm_min_epu8(lhs, rhs); }
+	static std::uint32_t mask(Block block) { return static_cast<std::uint32_t>(_mm_movemask_epi8(block)); }
+};
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+// the bytes from first to last, compared as unsigned numbers
+inline Vector::Block within(Vector::Block block, char first, char last)
+{
+	auto offset = Vector::minus(block, Vector::splat(first));
+	auto span = Vector::splat(static_cast<char>(last - first));
+	return Vector::equal(Vector::least(offset, span), offset);
+}
+
+/*
+ * Blocks are taken while all of their bytes match, found gets the mask of
+ * the matching bytes of a block; match decides the bytes of the tail.
+ */
+template <typename Found, typename Match>
+std::size_t skip(const std::string &text, std::size_t position, Found found, Match match)
+{
+	while (text.size() - position >= Vector::width) {
+		auto others = ~found(Vector::load(text.data() + position)) & Vector::all;
+		if (others != 0) {
+			return position + __builtin_ctz(others);
+		}
+		position += Vector::width;
+	}
+	while (position < text.size() && match(text[position])) {
+		++position;
+	}
+	return position;
+}
+
+inline std::size_t spaces(const std::string &text, std::size_t position, int &lines)
+{
+	return skip(text, position, [&](Vector::Block block) {
+		auto newlines = Vector::mask(Vector::equal(block, Vector::splat('\n')));
+		auto found = Vector::mask(Vector::either(Vector::equal(block, Vector::splat(' ')), within(block, '\t', '\r')));
+		auto others = ~found & Vector::all;
+		// only the newlines before the end of the run count
+		auto run = others != 0 ? (others & (0 - others)) - 1 : Vector::all;
+		lines += __builtin_popcount(newlines & run);
+		return found;
+	}, [&](char c) {
+		if (c == '\n') {
+			++lines;
+		}
+		return space(c);
+	});
+}
+
+inline std::size_t word(const std::string &text, std::size_t position)
+{
+	return skip(text, position, [](Vector::Block block) {
+		// setting the bit 0x20 makes capitals small and no other byte a letter
+		auto letters = within(Vector::either(block, Vector::splat(0x20)), 'a', 'z');
+		auto digits = within(block, '0', '9');
+		auto underscores = Vector::equal(block, Vector::splat('_'));
+		return Vector::mask(Vector::either(letters, Vector::either(digits, underscores)));
+	}, [](char c) {
+		return word(c);
+	});
+}
+
+inline std::size_t plain(const std::string &text, std::size_t position)
+{
+	return skip(text, position, [](Vector::Block block) {
+		auto special = Vector::either(Vector::equal(block, Vector::splat('"')), Vector::equal(block, Vector::splat('\\')));
+		return ~Vector::mask(special) & Vector::all;
+	}, [](char c) {
+		return plain(c);
+	});
+}
+#else
+inline std::size_t spaces(const std::string &text, std::size_t position, int &lines)
+{
+	for (; position < text.size() && space(text[position]); ++position) {
+		if (text[position] == '\n') {
+			++lines;
+		}
+	}
+	return position;
+}
+
+inline std::size_t word(const std::string &text, std::size_t position)
+{
+	while (position < text.size() && word(text[position])) {
+		++position;
+	}
+	return position;
+}
+
+inline std::size_t plain(const std::string &text, std::size_t position)
+{
+	while (position < text.size() && plain(text[position])) {
+		++position;
+	}
+	return position;
+}
+#endif
+
+}
\ No newline at end of file
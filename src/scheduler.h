@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <brick-shmem>
+
+/*
+ * Runs the iterations 0 .. count - 1 of a loop on a set of threads. Every
+ * worker starts with an equal share of the iterations and takes them one by
+ * one from the front of its share; once the share is done, the worker steals
+ * the back half of the largest share left. Shares are only ever split, so a
+ * worker which finds all of them empty is finished.
+ */
+struct Scheduler
+{
+	using Body = std::function<void(std::size_t worker, std::int64_t iteration)>;
+	using Done = std::function<void()>;
+
+	struct Share
+	{
+		brick::shmem::SpinLock lock;
+		// changed under the lock only, thieves read them without it
+		std::atomic<std::int64_t> begin{0};
+		std::atomic<std::int64_t> end{0};
+	};
+
+	struct Worker
+	{
+		Scheduler *scheduler;
+		std::size_t index;
+
+		void main()
+		{
+			scheduler->work(index);
+		}
+	};
+
+	std::vector<std::unique_ptr<Share>> shares;
+	Body body;
+	Done done;
+	std::atomic<bool> stopped;
+	brick::shmem::SpinLock errorLock;
+	std::int64_t failed = 0;
+	std::exception_ptr error;
+
+	Scheduler(std::size_t workers) : stopped(false)
+	{
+		for (std::size_t i = 0; i < workers; i++) {
+			shares.emplace_back(new Share);
+		}
+	}
+
+	/*
+	 * The calling thread is worker 0. When iterations throw, the remaining
+	 * ones are skipped and the error of the earliest iteration is rethrown.
+	 * Every worker calls workerDone once it finds no iterations left.
+	 */
+	void run(std::int64_t count, Body loopBody, Done workerDone = nullptr)
+	{
+		body = std::move(loopBody);
+		done = std::move(workerDone);
+		std::int64_t workers = shares.size();
+		for (std::int64_t i = 0; i < workers; i++) {
+			shares[i]->begin = count * i / workers;
+			shares[i]->end = count * (i + 1) / workers;
+		}
+
+		brick::shmem::ThreadSet<Worker> threads;
+		threads.reserve(shares.size());
+		for (std::size_t i = 1; i < shares.size(); i++) {
+			threads.emplace_back(Worker{this, i});
+		}
+		threads.start();
+		work(0);
+		threads.join();
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	void work(std::size_t worker)
+	{
+		std::int64_t iteration;
+		while (!stopped && (take(*shares[worker], iteration) || steal(worker, iteration))) {
+			try {
+				body(worker, iteration);
+			}
+			catch (...) {
+				std::lock_guard<brick::shmem::SpinLock> guard(errorLock);
+				if (!error || iteration < failed) {
+					error = std::current_exception();
+					failed = iteration;
+				}
+				stopped = true;
+			}
+		}
+		if (done) {
+			done();
+		}
+	}
+
+	bool take(Share &share, std::int64_t &iteration)
+	{
+		std::lock_guard<brick::shmem::SpinLock> guard(share.lock);
+		if (share.begin == share.end) {
+			return false;
+		}
+		iteration = share.begin++;
+		return true;
+	}
+
+	bool steal(std::size_t worker, std::int64_t &iteration)
+	{
+		while (true) {
+			Share *victim = nullptr;
+			std::int64_t largest = 0;
+			for (auto &share : shares) {
+				auto left = share->end - share->begin;
+				if (left > largest) {
+					victim = share.get();
+					largest = left;
+				}
+			}
+			if (victim == nullptr) {
+				return false;
+			}
+
+			std::int64_t begin, end;
+			{
+				std::lock_guard<brick::shmem::SpinLock> guard(victim->lock);
+				if (victim->begin == victim->end) {
+					// somebody was faster, look again
+					continue;
+				}
+				end = victim->end;
+				begin = victim->begin + (victim->end - victim->begin) / 2;
+				victim->end = begin;
+			}
+			if (begin == end) {
+				continue;
+			}
+
+			auto &own = *shares[worker];
+			std::lock_guard<brick::shmem::SpinLock> guard(own.lock);
+			own.begin = begin + 1;
+			own.end = end;
+			iteration = begin;
+			return true;
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,618 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <brick-hash>
+#include <brick-hashset>
+#include <brick-mmap>
+#include <brick-shmem>
+#include <brick-types>
+#include "integer.h"
+#include "memory.h"
+
+/*
+ * Copies of a String share its characters; they are only copied when the
+ * string is changed while another value still refers to it. The characters
+ * are counted to the memory of the run which created them.
+ */
+struct String
+{
+	String() : String(std::string()) {}
+
+	String(std::string str) : data(std::make_shared<Text>(std::move(str))) {}
+
+	String(const char *str) : String(std::string(str)) {}
+
+	const std::string &str() const
+	{
+		return data->str;
+	}
+
+	// settle has to follow once the string is changed
+	std::string &mutate()
+	{
+		if (data.use_count() > 1) {
+			data = std::make_shared<Text>(*data);
+		}
+		return data->str;
+	}
+
+	void settle()
+	{
+		data->charge.set(data->str.capacity());
+	}
+
+	std::size_t size() const
+	{
+		return data->str.size();
+	}
+
+	bool empty() const
+	{
+		return data->str.empty();
+	}
+
+private:
+	struct Text
+	{
+		std::string str;
+		Charge charge;
+
+		Text(std::string s) : str(std::move(s))
+		{
+			charge.set(str.capacity());
+		}
+	};
+
+	std::shared_ptr<Text> data;
+};
+
+inline bool operator==(const String &lhs, const String &rhs)
+{
+	return lhs.str() == rhs.str();
+}
+
+inline bool operator<(const String &lhs, const String &rhs)
+{
+	return lhs.str() < rhs.str();
+}
+
+inline std::ostream &operator<<(std::ostream &out, const String &s)
+{
+	return out << s.str();
+}
+
+struct Array;
+struct Map;
+struct Channel;
+struct Segment;
+
+using Value = brick::types::Union<String, Integer, Array, Map, Channel, Segment>;
+
+struct Elements;
+
+/*
+ * An array is a reference to its elements: copies of the value share them,
+ * so a change made through one variable is seen through all the others.
+ * The elements are counted to the memory of the run which created them.
+ */
+struct Array
+{
+	Array() : Array(0) {}
+
+	explicit Array(std::size_t size);
+
+	std::vector<Value> &elements() const;
+
+	// settle has to follow once elements are added
+	void settle() const;
+
+	// taken by the builtins, the workers of pfor share the array
+	std::mutex &lock() const;
+
+	bool same(const Array &other) const
+	{
+		return data == other.data;
+	}
+
+	const void *identity() const
+	{
+		return data.get();
+	}
+
+private:
+	std::shared_ptr<Elements> data;
+};
+
+struct Table;
+
+/*
+ * A map is shared the same way as an array. Its keys are integers or
+ * strings, they are hashed into a brick hash set of positions in a vector
+ * of entries, which also keeps the keys in the order of insertion.
+ */
+struct Map
+{
+	Map();
+
+	Value *find(const Value &key) const;
+	void put(const Value &key, const Value &value) const;
+	bool remove(const Value &key) const;
+	std::size_t size() const;
+	std::vector<Value> keys() const;
+
+	// taken by the builtins, the workers of pfor share the map
+	std::mutex &lock() const;
+
+	bool same(const Map &other) const
+	{
+		return data == other.data;
+	}
+
+	const void *identity() const
+	{
+		return data.get();
+	}
+
+private:
+	std::shared_ptr<Table> data;
+};
+
+struct Pipe;
+
+/*
+ * A channel passes values between coroutines and threads in the order they
+ * were sent. It holds at most capacity values; send fails while it is full
+ * or once it is closed and receive fails while it is empty.
+ */
+struct Channel
+{
+	explicit Channel(std::size_t capacity);
+
+	bool send(const Value &value) const;
+	bool receive(Value &value) const;
+	void close() const;
+
+	bool full() const;
+	bool empty() const;
+	bool closed() const;
+	std::size_t size() const;
+
+	bool same(const Channel &other) const
+	{
+		return data == other.data;
+	}
+
+	bool before(const Channel &other) const
+	{
+		return std::less<Pipe *>()(data.get(), other.data.get());
+	}
+
+private:
+	std::shared_ptr<Pipe> data;
+};
+
+/*
+ * A segment is a named shared memory object of integers mapped by brick-mmap.
+ * Processes forked after it was mapped share it, as do all the processes
+ * which map the same name, so its cells are accessed atomically only.
+ */
+struct Segment
+{
+	// the descriptor belongs to the segment once it is mapped
+	Segment(std::string name, int fd);
+
+	const std::string &name() const
+	{
+		return label;
+	}
+
+	std::size_t size() const;
+	std::atomic<std::int64_t> &cell(std::size_t index) const;
+
+private:
+	std::string label;
+	std::shared_ptr<brick::mmap::MMap> data;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared cells need lock-free atomics");
+
+/*
+ * An array or a map may hold itself, directly or through others. Those being
+ * printed, compared or sent are kept here while they are walked, so that a
+ * walk which meets one of them again stops there instead of going around.
+ */
+struct Visiting
+{
+	using Key = std::pair<const void *, const void *>;
+
+	bool repeated;
+
+	Visiting(const void *lhs, const void *rhs = nullptr) : key(lhs, rhs)
+	{
+		auto &keys = active();
+		repeated = std::find(keys.begin(), keys.end(), key) != keys.end();
+		if (!repeated) {
+			keys.push_back(key);
+		}
+	}
+
+	Visiting(const Visiting &) = delete;
+
+	~Visiting()
+	{
+		if (!repeated) {
+			active().pop_back();
+		}
+	}
+
+private:
+	Key key;
+
+	static std::vector<Key> &active()
+	{
+		static thread_local std::vector<Key> keys;
+		return keys;
+	}
+};
+
+struct Elements
+{
+	std::vector<Value> values;
+	std::mutex lock;
+	Charge charge;
+};
+
+inline Array::Array(std::size_t size) : data(std::make_shared<Elements>())
+{
+	// counted first, so that an array over the limit is never allocated
+	data->charge.set(size * sizeof(Value));
+	data->values.resize(size, Value(0));
+	settle();
+}
+
+inline std::vector<Value> &Array::elements() const
+{
+	return data->values;
+}
+
+inline void Array::settle() const
+{
+	data->charge.set(data->values.capacity() * sizeof(Value));
+}
+
+inline std::mutex &Array::lock() const
+{
+	return data->lock;
+}
+
+// a pair met again inside itself is taken as equal
+inline bool operator==(const Array &lhs, const Array &rhs)
+{
+	if (lhs.same(rhs)) {
+		return true;
+	}
+	Visiting visiting(lhs.identity(), rhs.identity());
+	return visiting.repeated || lhs.elements() == rhs.elements();
+}
+
+inline bool operator<(const Array &lhs, const Array &rhs)
+{
+	if (lhs.same(rhs)) {
+		return false;
+	}
+	Visiting visiting(lhs.identity(), rhs.identity());
+	return !visiting.repeated && lhs.elements() < rhs.elements();
+}
+
+struct Table
+{
+	struct Entry
+	{
+		Value key;
+		Value value;
+		bool live;
+	};
+
+	struct Hasher
+	{
+		const Table *table;
+
+		brick::hash::hash128_t hash(std::int64_t position) const
+		{
+			return Table::hash(table->entries[position].key);
+		}
+
+		bool equal(std::int64_t lhs, std::int64_t rhs) const
+		{
+			return lhs == rhs;
+		}
+
+		bool equal(std::int64_t position, const Value &key) const
+		{
+			return table->entries[position].key == key;
+		}
+	};
+
+	std::vector<Entry> entries;
+	brick::hashset::Fast<std::int64_t, Hasher> positions;
+	std::size_t live = 0;
+	std::mutex lock;
+	Charge charge;
+
+	Table() : positions(Hasher{this}) {}
+
+	Table(const Table &) = delete;
+
+	static brick::hash::hash128_t hash(const Value &key)
+	{
+		brick::hash::hash128_t result;
+		if (key.is<String>()) {
+			auto &str = key.get<String>().str();
+			result = brick::hash::spooky(str.data(), str.size());
+		} else if (key.get<Integer>().isSmall()) {
+			auto value = key.get<Integer>().small();
+			result = brick::hash::spooky(&value, sizeof(value), 1);
+		} else {
+			auto str = key.get<Integer>().toString();
+			result = brick::hash::spooky(str.data(), str.size(), 2);
+		}
+		// a zero hash marks an empty cell of the set
+		if (result.first == 0) {
+			result.first = 1;
+		}
+		return result;
+	}
+
+	Entry *find(const Value &key)
+	{
+		auto found = positions.findHinted(key, hash(key).first);
+		return found.valid() ? &entries[*found] : nullptr;
+	}
+
+	void insert(const Value &key, const Value &value)
+	{
+		auto found = positions.findHinted(key, hash(key).first);
+		entries.push_back(Entry{key, value, true});
+		++live;
+		if (found.valid()) {
+			// the key was removed before, it moves to the end
+			*found = entries.size() - 1;
+		} else {
+			positions.insertHinted(entries.size() - 1, hash(key).first);
+		}
+		settle();
+	}
+
+	void settle()
+	{
+		using Cell = decltype(positions)::Table::value_type;
+		charge.set(entries.capacity() * sizeof(Entry) + positions.size() * sizeof(Cell));
+	}
+
+	// drops removed entries once they outnumber the live ones
+	void compact()
+	{
+		if (entries.size() < 2 * live + 16) {
+			return;
+		}
+		std::vector<Entry> old;
+		std::swap(old, entries);
+		positions = brick::hashset::Fast<std::int64_t, Hasher>(Hasher{this});
+		live = 0;
+		for (auto &entry : old) {
+			if (entry.live) {
+				insert(entry.key, entry.value);
+			}
+		}
+		settle();
+	}
+};
+
+inline Map::Map() : data(std::make_shared<Table>()) {}
+
+inline Value *Map::find(const Value &key) const
+{
+	auto entry = data->find(key);
+	return (entry != nullptr && entry->live) ? &entry->value : nullptr;
+}
+
+inline void Map::put(const Value &key, const Value &value) const
+{
+	auto entry = data->find(key);
+	if (entry == nullptr || !entry->live) {
+		data->insert(key, value);
+		return;
+	}
+	entry->value = value;
+}
+
+inline bool Map::remove(const Value &key) const
+{
+	auto entry = data->find(key);
+	if (entry == nullptr || !entry->live) {
+		return false;
+	}
+	entry->live = false;
+	entry->value = Value();
+	--data->live;
+	data->compact();
+	return true;
+}
+
+inline std::size_t Map::size() const
+{
+	return data->live;
+}
+
+inline std::vector<Value> Map::keys() const
+{
+	std::vector<Value> result;
+	for (auto &entry : data->entries) {
+		if (entry.live) {
+			result.push_back(entry.key);
+		}
+	}
+	return result;
+}
+
+inline std::mutex &Map::lock() const
+{
+	return data->lock;
+}
+
+inline bool operator==(const Map &lhs, const Map &rhs)
+{
+	if (lhs.same(rhs)) {
+		return true;
+	}
+	if (lhs.size() != rhs.size()) {
+		return false;
+	}
+	Visiting visiting(lhs.identity(), rhs.identity());
+	if (visiting.repeated) {
+		return true;
+	}
+	for (auto &key : lhs.keys()) {
+		auto value = rhs.find(key);
+		if (value == nullptr || !(*value == *lhs.find(key))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool operator<(const Map &lhs, const Map &rhs)
+{
+	auto entries = [](const Map &map) {
+		std::vector<std::pair<Value, Value>> result;
+		for (auto &key : map.keys()) {
+			result.emplace_back(key, *map.find(key));
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	};
+	if (lhs.same(rhs)) {
+		return false;
+	}
+	Visiting visiting(lhs.identity(), rhs.identity());
+	return !visiting.repeated && entries(lhs) < entries(rhs);
+}
+
+/*
+ * The values are kept in a brick Fifo, which allows one thread to push while
+ * another one pops. Senders and receivers each take the lock of their end, so
+ * any number of them may share the channel without ever blocking the other
+ * end. The count is raised under the send lock before a push and lowered
+ * after a pop, so it is never less than the number of values in the fifo.
+ * Only the holder of the receive lock may look at the front of the fifo, a
+ * pop may drop the block under anybody else; the others go by the count.
+ */
+struct Pipe
+{
+	// blocks of the default size take a hundred kilobytes, too much for a channel
+	brick::shmem::Fifo<Value, 256> values;
+	brick::shmem::SpinLock sendLock;
+	brick::shmem::SpinLock receiveLock;
+	std::atomic<std::size_t> count{0};
+	std::atomic<bool> closed{false};
+	std::size_t capacity;
+
+	Pipe(std::size_t capacity) : capacity(capacity) {}
+};
+
+inline Channel::Channel(std::size_t capacity) : data(std::make_shared<Pipe>(capacity)) {}
+
+inline bool Channel::send(const Value &value) const
+{
+	std::lock_guard<brick::shmem::SpinLock> guard(data->sendLock);
+	if (data->closed || data->count >= data->capacity) {
+		return false;
+	}
+	++data->count;
+	data->values.push(value);
+	return true;
+}
+
+inline bool Channel::receive(Value &value) const
+{
+	std::lock_guard<brick::shmem::SpinLock> guard(data->receiveLock);
+	if (data->values.empty()) {
+		return false;
+	}
+	// the slot is only reused once its block is dropped, do not keep the value alive
+	value = std::move(data->values.front());
+	data->values.front() = Value();
+	data->values.pop();
+	--data->count;
+	return true;
+}
+
+inline void Channel::close() const
+{
+	std::lock_guard<brick::shmem::SpinLock> guard(data->sendLock);
+	data->closed = true;
+}
+
+inline bool Channel::full() const
+{
+	return data->count >= data->capacity;
+}
+
+// a value being sent makes the channel non-empty a moment early
+inline bool Channel::empty() const
+{
+	return data->count == 0;
+}
+
+inline bool Channel::closed() const
+{
+	return data->closed;
+}
+
+inline std::size_t Channel::size() const
+{
+	return data->count;
+}
+
+inline bool operator==(const Channel &lhs, const Channel &rhs)
+{
+	return lhs.same(rhs);
+}
+
+inline bool operator<(const Channel &lhs, const Channel &rhs)
+{
+	return lhs.before(rhs);
+}
+
+inline Segment::Segment(std::string name, int fd)
+	: label(std::move(name)),
+	  data(std::make_shared<brick::mmap::MMap>(fd, brick::mmap::ProtectMode::Read | brick::mmap::ProtectMode::Write |
+	                                                   brick::mmap::ProtectMode::Shared))
+{}
+
+inline std::size_t Segment::size() const
+{
+	return data->size() / sizeof(std::int64_t);
+}
+
+inline std::atomic<std::int64_t> &Segment::cell(std::size_t index) const
+{
+	return data->asArrayOf<std::atomic<std::int64_t>>()[index];
+}
+
+inline bool operator==(const Segment &lhs, const Segment &rhs)
+{
+	return lhs.name() == rhs.name();
+}
+
+inline bool operator<(const Segment &lhs, const Segment &rhs)
+{
+	return lhs.name() < rhs.name();
+}
\ No newline at end of file
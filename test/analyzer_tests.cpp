@@ -51,4 +51,52 @@ TEST_CASE("Examples2") {
 	Analyzer a7(cwd + std::string("files/Prime.txt"));
 	REQUIRE_NOTHROW(tl = a7.toplevel());
 	REQUIRE(tl.globals.size() > 0);
+}
+
+TEST_CASE("Constants") {
+	Toplevel tl;
+
+	Analyzer a(cwd + std::string("files/Append.txt"));
+	REQUIRE_NOTHROW(tl = a.toplevel());
+	REQUIRE(tl.constants.size() == 7);
+
+	Analyzer plain(cwd + std::string("files/Append.txt"));
+	plain.optimize = false;
+	REQUIRE_NOTHROW(tl = plain.toplevel());
+	REQUIRE(tl.constants.size() == 7);
+}
+
+TEST_CASE("Builtins") {
+	Toplevel tl;
+
+	Analyzer a1(cwd + std::string("files/Error56_builtins.txt"));
+	REQUIRE_THROWS_AS(tl = a1.toplevel(), BadArity);
+
+	Analyzer a2(cwd + std::string("files/Error57_builtins.txt"));
+	REQUIRE_THROWS_AS(tl = a2.toplevel(), BadSymbol);
+
+	Analyzer a3(cwd + std::string("files/Arrays.txt"));
+	REQUIRE_NOTHROW(tl = a3.toplevel());
+
+	// a builtin would hide the system call of the same name
+	for (auto &builtin : builtins()) {
+		auto name = builtin.name;
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+		INFO(builtin.name);
+		REQUIRE(dlsym(NULL, name.c_str()) == nullptr);
+	}
+}
+
+
+TEST_CASE("Independent calls") {
+	Toplevel tl;
+	Analyzer a(cwd + std::string("files/Parallel.txt"));
+	REQUIRE_NOTHROW(tl = a.toplevel());
+
+	std::vector<bool> correct{true, false, true, false, true, true};
+	std::vector<bool> independent;
+	for (auto &global : tl.globals) {
+		global.match([&](Call &c) { independent.push_back(c.isIndependent); });
+	}
+	REQUIRE(independent == correct);
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include <csignal>
+#include <sstream>
+#include <sys/wait.h>
+#include "catch.hpp"
+#include "daemon.h"
+#include "cwd.h"
+
+std::string request(const std::string &socketPath, const std::string &req)
+{
+	std::stringstream out;
+	for (int attempt = 0; ; ++attempt) {
+		try {
+			Daemon::send(socketPath, req, out);
+			return out.str();
+		}
+		catch (DaemonError) {
+			// the daemon may not be listening yet
+			if (attempt == 100) {
+				throw;
+			}
+			usleep(10000);
+		}
+	}
+}
+
+TEST_CASE("Daemon") {
+	std::string socketPath = "/tmp/interpreter-test-" + std::to_string(getpid()) + ".sock";
+	auto pid = fork();
+	REQUIRE(pid >= 0);
+	if (pid == 0) {
+		try {
+			Daemon(socketPath).serve();
+		}
+		catch (DaemonError) {}
+		_exit(1);
+	}
+
+	std::string factorial = "1\n1\n2\n6\n24\n120\n720\n1\n1\n2\n6\n24\n120\n720\n";
+	auto path = Daemon::pathRequest(cwd + std::string("files/Factorial.txt"));
+	REQUIRE(request(socketPath, path) == factorial);
+
+	// a client which sends nothing does not hold up the others
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath.c_str());
+	int silent = socket(AF_UNIX, SOCK_STREAM, 0);
+	REQUIRE(connect(silent, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+	// the second run may come from the cache of a worker
+	REQUIRE(request(socketPath, path) == factorial);
+
+	std::string source = "func Twice(n) (\n(return (* n 2))\n)\nTwice(21)\n";
+	REQUIRE(request(socketPath, Daemon::sourceRequest(source)) == "42\n");
+	REQUIRE(request(socketPath, Daemon::sourceRequest("func (")).find("42") == std::string::npos);
+
+	// the exit status of a failed run reaches the client
+	std::string failing = "func Fail() (\n(return (- Array(1) 1))\n)\nFail()\n";
+	REQUIRE(request(socketPath, Daemon::sourceRequest(failing)).find("exited with status 1") != std::string::npos);
+	close(silent);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+	unlink(socketPath.c_str());
+}
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <chrono>
 #include "catch.hpp"
 #include "evaluator.h"
 #include "cwd.h"
@@ -50,4 +51,398 @@ TEST_CASE("Prime") {
 	REQUIRE_NOTHROW(values = e.eval());
 	REQUIRE(values.size() == correct.size());
 	REQUIRE(values == correct);
+}
+
+TEST_CASE("Tail recursion") {
+	Evaluator e(cwd + std::string("files/TailRecursion.txt"));
+	std::vector<Value> correct{100000, 500500, 2000};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Short circuit") {
+	Evaluator e(cwd + std::string("files/ShortCircuit.txt"));
+	std::vector<Value> correct{0, 1, 0, 1, 4, 0, 5};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Append") {
+	Evaluator e(cwd + std::string("files/Append.txt"));
+	std::vector<Value> correct{"ababab", "1-2-3-4-5-6-7-8-9-0-1-2-", 55, "123", "a0", 200000};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Big numbers") {
+	Evaluator e(cwd + std::string("files/BigNumbers.txt"));
+	std::vector<Value> correct{Integer::parse("15511210043330985984000000"), 870, 976371285, -36472996,
+	                           Integer::parse("-377170786403"), 5, 1,
+	                           Integer::parse("6277101735386680763835789423207666416102355444464034512896"), 158,
+	                           "n = -9223372036854775809"};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Arrays") {
+	auto array = [](std::vector<Value> elements) {
+		Array a;
+		a.elements() = elements;
+		return Value(a);
+	};
+
+	Evaluator e(cwd + std::string("files/Arrays.txt"));
+	std::vector<Value> correct{array({0, 1, 4, 9, 16}), 328350, 1229, array({2, 3, 5, 7, 11, 13, 17, 19, 23, 29}),
+	                           array({0, "x"}), 10, 4};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Maps") {
+	auto map = [](std::vector<std::pair<Value, Value>> entries) {
+		Map m;
+		for (auto &entry : entries) {
+			m.put(entry.first, entry.second);
+		}
+		return Value(m);
+	};
+	Array keys;
+	keys.elements() = {"to", "be", "or", "not"};
+
+	Evaluator e(cwd + std::string("files/Maps.txt"));
+	std::vector<Value> correct{map({{"to", 2}, {"be", 2}, {"or", 1}, {"not", 1}}), keys, "5000:25005000:10",
+	                           map({{1, "int"}, {Integer::parse("123456789012345678901234567890"), "big"}, {"1", "again"}}),
+	                           "big"};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values.size() == correct.size());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Cycles") {
+	Evaluator e(Source{"func Cycles() (\n"
+	                   "\t(var a Array(1))\n"
+	                   "\t(Set(a 0 a))\n"
+	                   "\t(var b Array(1))\n"
+	                   "\t(Set(b 0 b))\n"
+	                   "\t(var m Map())\n"
+	                   "\t(Put(m 1 m))\n"
+	                   "\t(return (+ \"\" a \" \" m \" \" (== a b) \" \" (< a b)))\n"
+	                   ")\n"
+	                   "Cycles()"});
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == std::vector<Value>{"[[...]] {1: {...}} 1 0"});
+}
+
+
+TEST_CASE("Cache") {
+	for (auto name : {"Factorial.txt", "Append.txt", "BigNumbers.txt", "Maps.txt", "TailRecursion.txt"}) {
+		auto file = cwd + std::string("files/") + name;
+		std::remove((file + ".cache").c_str());
+
+		Evaluator analyzed(file);
+		analyzed.cache = true;
+		std::vector<Value> correct;
+		REQUIRE_NOTHROW(correct = analyzed.eval());
+		REQUIRE(std::ifstream(file + ".cache").good());
+
+		Evaluator cached(file);
+		cached.cache = true;
+		std::vector<Value> values;
+		REQUIRE_NOTHROW(values = cached.eval());
+		REQUIRE(values == correct);
+
+		std::stringstream program, cachedProgram;
+		program << analyzed.toplevel;
+		cachedProgram << cached.toplevel;
+		REQUIRE(cachedProgram.str() == program.str());
+		REQUIRE(cached.toplevel.constants.size() == analyzed.toplevel.constants.size());
+
+		std::remove((file + ".cache").c_str());
+	}
+}
+
+TEST_CASE("Parallel") {
+	for (auto name : {"Parallel.txt", "Prime.txt", "Fibonacci.txt"}) {
+		auto file = cwd + std::string("files/") + name;
+		std::vector<Value> correct;
+		std::vector<Value> values;
+
+		Evaluator sequential(file);
+		REQUIRE_NOTHROW(correct = sequential.eval());
+
+		Evaluator e(file);
+		e.parallel = true;
+		REQUIRE_NOTHROW(values = e.eval());
+		REQUIRE(values == correct);
+	}
+
+	Evaluator e(cwd + std::string("files/Parallel.txt"));
+	e.parallel = true;
+	std::vector<Value> correct{111, 1, 118, 17, 178, 5};
+	std::vector<Value> values;
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Parallel for") {
+	auto array = [](std::vector<Value> values) {
+		Array a;
+		a.elements() = values;
+		return Value(a);
+	};
+
+	Evaluator e(cwd + std::string("files/ParallelFor.txt"));
+	std::vector<Value> correct{338350, array({0, 1, 4, 9, 16}), array({3, 4, 3}), 5, 0, (- 150), 1009};
+	std::vector<Value> values;
+
+	REQUIRE_THROWS_AS(values = e.eval(), RuntimeError);
+	e.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = e.run());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Loop bounds") {
+	auto loop = [](std::string keyword, std::string from, std::string to) {
+		Evaluator e(Source{"func Count() (\n"
+		                   "\t(var n 0)\n"
+		                   "\t(" + keyword + " (var i from " + from + " to " + to + ") (\n"
+		                   "\t\t(= n 1)\n"
+		                   "\t))\n"
+		                   "\t(return n)\n"
+		                   ")\n"
+		                   "Count()"});
+		return e.eval();
+	};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = loop("for", "1", "3"));
+	REQUIRE(values == std::vector<Value>{1});
+	REQUIRE_THROWS_AS(values = loop("for", "1", "100000000000000000000"), RuntimeError);
+	REQUIRE_THROWS_AS(values = loop("for", "(- 100000000000000000000)", "1"), RuntimeError);
+	REQUIRE_THROWS_AS(values = loop("for", "\"a\"", "1"), RuntimeError);
+	REQUIRE_THROWS_AS(values = loop("pfor", "1", "100000000000000000000"), RuntimeError);
+	REQUIRE_THROWS_AS(values = loop("pfor", "\"a\"", "1"), RuntimeError);
+}
+
+TEST_CASE("Operand types") {
+	auto run = [](std::string expression) {
+		Evaluator e(Source{"func Compute() (\n"
+		                   "\t(return " + expression + ")\n"
+		                   ")\n"
+		                   "Compute()"});
+		return e.eval();
+	};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = run("(+ 1 \"a\" 2)"));
+	REQUIRE(values == std::vector<Value>{"1a2"});
+	REQUIRE_THROWS_AS(values = run("(- Array(3) 1)"), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("(* Map() 2)"), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("(+ 1 Array(3))"), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("(/ 6 \"a\")"), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("(% Map() 2)"), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("(- \"a\")"), RuntimeError);
+}
+
+TEST_CASE("Coroutines") {
+	Array order;
+	order.elements() = {10, 60};
+	// the five sleeps of Sleepers overlap, all of them start before any ends
+	Array events;
+	events.elements() = {"sleep", "sleep", "sleep", "sleep", "sleep", "wake", "wake", "wake", "wake", "wake", 500};
+
+	Evaluator e(cwd + std::string("files/Coroutines.txt"));
+	std::vector<Value> correct{"a:55 b:5050", 20, order, events, 1};
+	std::vector<Value> values;
+
+	REQUIRE_THROWS_AS(values = e.eval(), RuntimeError);
+	e.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = e.run());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Channels") {
+	Evaluator e(cwd + std::string("files/Channels.txt"));
+	std::vector<Value> correct{385, 5050, "ab0", 210, 465};
+	std::vector<Value> values;
+
+	REQUIRE_THROWS_AS(values = e.eval(), RuntimeError);
+	e.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = e.run());
+	REQUIRE(values == correct);
+
+	// the independent calls run at once, each with the threads of its pfor
+	Evaluator parallel(cwd + std::string("files/Channels.txt"));
+	parallel.parallel = true;
+	parallel.load();
+	parallel.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = parallel.run());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Fork map") {
+	auto array = [](std::vector<Value> values) {
+		Array a;
+		a.elements() = values;
+		return Value(a);
+	};
+
+	Evaluator e(cwd + std::string("files/ForkMap.txt"));
+	std::vector<Value> correct{array({1, 8, 27, 64, 125}), Integer::parse("10000000000000000000000000"), "-772",
+	                           array({1, 2, 1, 2}), 0, 0};
+	std::vector<Value> values;
+
+	REQUIRE_THROWS_AS(values = e.eval(), RuntimeError);
+	e.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = e.run());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Shared segments") {
+	Evaluator e(cwd + std::string("files/Segments.txt"));
+	std::vector<Value> correct{"5050 100 2", "019", 0};
+	std::vector<Value> values;
+
+	REQUIRE_THROWS_AS(values = e.eval(), RuntimeError);
+	e.toplevel.globals.pop_back();
+	REQUIRE_NOTHROW(values = e.run());
+	REQUIRE(values == correct);
+}
+
+TEST_CASE("Source") {
+	std::string text = "func Twice(n) (\n\t(return (* 2 n))\n)\n";
+	for (int i = 1; i <= 3; i++) {
+		text += "Twice(" + std::to_string(i) + ")\n";
+	}
+
+	Evaluator e(Source{text});
+	std::vector<Value> correct{2, 4, 6};
+	std::vector<Value> values;
+
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+
+	Evaluator broken(Source{"Twice(1"});
+	REQUIRE_THROWS_AS(values = broken.eval(), BadParse);
+}
+
+TEST_CASE("Limits") {
+	std::string functions =
+		"func Forever() (\n"
+		"\t(var i 0)\n"
+		"\t(while (>= i 0) (\n"
+		"\t\t(= i (+ i 1))\n"
+		"\t))\n"
+		"\t(return i)\n"
+		")\n"
+		"func Deep(n) (\n"
+		"\t(if (== n 0) (\n"
+		"\t\t(return 0)\n"
+		"\t))\n"
+		"\t(return (+ 1 Deep((- n 1))))\n"
+		")\n"
+		"func Spin(n) (\n"
+		"\t(if (== n 0) (\n"
+		"\t\t(return 0)\n"
+		"\t))\n"
+		"\t(return Spin((- n 1)))\n"
+		")\n";
+	auto run = [&](std::string call, Limits limits) {
+		Evaluator e(Source{functions + call});
+		e.limits = limits;
+		return e.eval();
+	};
+	std::vector<Value> values;
+
+	Limits statements;
+	statements.statements = 100000;
+	REQUIRE_THROWS_AS(values = run("Forever()", statements), RuntimeError);
+	REQUIRE_THROWS_AS(values = run("Spin(1000000)", statements), RuntimeError);
+	REQUIRE_NOTHROW(values = run("Spin(1000)", statements));
+
+	Limits depth;
+	depth.depth = 100;
+	REQUIRE_THROWS_AS(values = run("Deep(200)", depth), RuntimeError);
+	REQUIRE_NOTHROW(values = run("Deep(50)", depth));
+	REQUIRE(values == std::vector<Value>{50});
+	// tail calls do not nest
+	REQUIRE_NOTHROW(values = run("Spin(1000)", depth));
+
+	Limits time;
+	time.time = std::chrono::milliseconds(50);
+	auto begin = std::chrono::steady_clock::now();
+	REQUIRE_THROWS_AS(values = run("Forever()", time), RuntimeError);
+	REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(2));
+}
+
+TEST_CASE("Memory") {
+	std::string functions =
+		"func Repeat(piece n) (\n"
+		"\t(var s \"\")\n"
+		"\t(for (var i from 1 to n) (\n"
+		"\t\t(= s (+ s piece))\n"
+		"\t))\n"
+		"\t(return Len(s))\n"
+		")\n";
+	std::vector<Value> values;
+
+	Evaluator large(Source{functions + "Repeat(\"abcd\" 100000)"});
+	large.limits.memory = 100000;
+	REQUIRE_THROWS_AS(values = large.eval(), RuntimeError);
+
+	Evaluator small(Source{functions + "Repeat(\"abcd\" 1000)"});
+	small.limits.memory = 100000;
+	REQUIRE_NOTHROW(values = small.eval());
+	REQUIRE(values == std::vector<Value>{4000});
+	REQUIRE(small.memory->peak >= 4000);
+	REQUIRE(small.memory->peak <= 100000);
+
+	Evaluator measured(Source{functions + "Repeat(\"abcd\" 100000)"});
+	measured.measureMemory = true;
+	REQUIRE_NOTHROW(values = measured.eval());
+	REQUIRE(measured.memory->peak >= 400000);
+	// the string is gone once the run is over
+	REQUIRE(measured.memory->used < measured.memory->peak);
+
+	// arrays and maps are counted as well
+	std::string containers =
+		"func Fill(n) (\n"
+		"\t(var m Map())\n"
+		"\t(for (var i from 1 to n) (\n"
+		"\t\t(Put(m i i))\n"
+		"\t))\n"
+		"\t(return Len(m))\n"
+		")\n";
+	Evaluator array(Source{containers + "Len(Array(1000000))"});
+	array.limits.memory = 100000;
+	REQUIRE_THROWS_AS(values = array.eval(), RuntimeError);
+
+	Evaluator map(Source{containers + "Fill(100000)"});
+	map.limits.memory = 100000;
+	REQUIRE_THROWS_AS(values = map.eval(), RuntimeError);
+
+	Evaluator fits(Source{containers + "Fill(100)\nLen(Array(100))"});
+	fits.limits.memory = 100000;
+	std::vector<Value> sizes{100, 100};
+	REQUIRE_NOTHROW(values = fits.eval());
+	REQUIRE(values == sizes);
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include <thread>
+#include "catch.hpp"
+#include "interpreter.h"
+#include "cwd.h"
+
+TEST_CASE("Library") {
+	auto array = [](std::vector<Value> elements) {
+		Array a;
+		a.elements() = elements;
+		return Value(a);
+	};
+	std::vector<Value> correct{array({0, 1, 4, 9, 16}), 328350, 1229, array({2, 3, 5, 7, 11, 13, 17, 19, 23, 29}),
+	                           array({0, "x"}), 10, 4};
+
+	Program program(cwd + std::string("files/Arrays.txt"));
+	Context context(program);
+	REQUIRE(context.run() == correct);
+	// a context starts over on every run
+	REQUIRE(context.run() == correct);
+
+	// contexts on many threads share one program
+	std::vector<std::vector<Value>> results(4);
+	std::vector<std::thread> threads;
+	for (auto &result : results) {
+		threads.emplace_back([&] {
+			Context own(program);
+			for (int i = 0; i < 3; i++) {
+				result = own.run();
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	for (auto &result : results) {
+		REQUIRE(result == correct);
+	}
+
+	Context generated(Program(Source{"func Answer() (\n\t(return 42)\n)\nAnswer()"}));
+	REQUIRE(generated.run() == std::vector<Value>{42});
+
+	REQUIRE_THROWS_AS(Program(cwd + std::string("files/Error56_builtins.txt")), ScriptError);
+	Program failing(cwd + std::string("files/ParallelFor.txt"));
+	REQUIRE_THROWS_AS(Context(failing).run(), ScriptError);
+}
\ No newline at end of file
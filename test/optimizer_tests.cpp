@@ -0,0 +1,125 @@
+#include <sstream>
+#include "catch.hpp"
+#include "evaluator.h"
+#include "cwd.h"
+
+static std::string function(Toplevel &tl, std::string name)
+{
+	std::stringstream s;
+	for (auto &global : tl.globals) {
+		global.match([&](Func &f) {
+			if (f.name.token.text == name) {
+				s << f;
+			}
+		});
+	}
+	return s.str();
+}
+
+TEST_CASE("Inlining") {
+	std::vector<Value> correct{385, 7, 7, 9, 17, 0, 106, 1, 16};
+	std::vector<Value> values;
+
+	Evaluator e(cwd + std::string("files/Inline.txt"));
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+
+	Evaluator plain(cwd + std::string("files/Inline.txt"));
+	plain.analyzer->optimize = false;
+	REQUIRE_NOTHROW(values = plain.eval());
+	REQUIRE(values == correct);
+
+	Toplevel tl;
+	Analyzer a(cwd + std::string("files/Inline.txt"));
+	REQUIRE_NOTHROW(tl = a.toplevel());
+	REQUIRE(function(tl, "SumSquares").find("Square(") == std::string::npos);
+	REQUIRE(function(tl, "Distance").find("Absolute(") == std::string::npos);
+	REQUIRE(function(tl, "ClampAll").find("Clamp(") == std::string::npos);
+	REQUIRE(function(tl, "Last").find("Square(") == std::string::npos);
+	REQUIRE(function(tl, "Shadow").find("Scaled(") != std::string::npos);
+}
+
+TEST_CASE("Loop invariants and common subexpressions") {
+	std::vector<Value> correct{111, 66, 0, 8, 34, 12};
+	std::vector<Value> values;
+
+	Evaluator e(cwd + std::string("files/Invariant.txt"));
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+
+	Evaluator plain(cwd + std::string("files/Invariant.txt"));
+	plain.analyzer->optimize = false;
+	REQUIRE_NOTHROW(values = plain.eval());
+	REQUIRE(values == correct);
+
+	Toplevel tl;
+	Analyzer a(cwd + std::string("files/Invariant.txt"));
+	REQUIRE_NOTHROW(tl = a.toplevel());
+	REQUIRE(function(tl, "Invariant").find("(var inv$") != std::string::npos);
+	REQUIRE(function(tl, "Invariant").find("(< i inv$") != std::string::npos);
+	REQUIRE(function(tl, "Drift").find("(var inv$") == std::string::npos);
+	REQUIRE(function(tl, "SafeDivide").find("(= count (+ count (/ n d)))") != std::string::npos);
+	REQUIRE(function(tl, "Common").find("(var cse$") != std::string::npos);
+	REQUIRE(function(tl, "Common").find("(var z (+ a b))") != std::string::npos);
+	REQUIRE(function(tl, "Barrier").find("(var cse$") == std::string::npos);
+}
+
+static std::size_t frameSize(Toplevel &tl, std::string name)
+{
+	std::size_t size = 0;
+	for (auto &global : tl.globals) {
+		global.match([&](Func &f) {
+			if (f.name.token.text == name) {
+				size = f.frameSize;
+			}
+		});
+	}
+	return size;
+}
+
+TEST_CASE("Dead code") {
+	std::vector<Value> correct{6, 12, 3};
+	std::vector<Value> values;
+
+	Evaluator e(cwd + std::string("files/DeadCode.txt"));
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+
+	Evaluator plain(cwd + std::string("files/DeadCode.txt"));
+	plain.analyzer->optimize = false;
+	REQUIRE_NOTHROW(values = plain.eval());
+	REQUIRE(values == correct);
+
+	Toplevel tl, original;
+	Analyzer a(cwd + std::string("files/DeadCode.txt"));
+	REQUIRE_NOTHROW(tl = a.toplevel());
+	Analyzer b(cwd + std::string("files/DeadCode.txt"));
+	b.optimize = false;
+	REQUIRE_NOTHROW(original = b.toplevel());
+
+	REQUIRE(function(tl, "Unused").empty());
+	REQUIRE(function(tl, "Early").find("waste") == std::string::npos);
+	REQUIRE(function(tl, "Early").find("if") == std::string::npos);
+	REQUIRE(function(tl, "Early").find("while") == std::string::npos);
+	REQUIRE(function(tl, "Early").find("Write") == std::string::npos);
+	REQUIRE(frameSize(tl, "Early") < frameSize(original, "Early"));
+	REQUIRE(function(tl, "Scoped").find("(var x 10)") != std::string::npos);
+	REQUIRE(function(tl, "Branches").find("42") == std::string::npos);
+}
+
+TEST_CASE("Computed function names") {
+	std::string text = "func Foo(x) (\n\t(return (* 2 x))\n)\n"
+	                   "func Run(name) (\n\t(return Await(Spawn(name 21)))\n)\n"
+	                   "Run((+ \"Fo\" \"o\"))\n";
+
+	Evaluator e(Source{text});
+	std::vector<Value> correct{42};
+	std::vector<Value> values;
+	REQUIRE_NOTHROW(values = e.eval());
+	REQUIRE(values == correct);
+
+	Toplevel tl;
+	Analyzer a(Source{text});
+	REQUIRE_NOTHROW(tl = a.toplevel());
+	REQUIRE(!function(tl, "Foo").empty());
+}
\ No newline at end of file
@@ -258,3 +258,122 @@ TEST_CASE("Others") {
 	Parser p3(cwd + std::string("files/Error03.txt"));
 	REQUIRE_THROWS_AS(tl = p3.toplevel(), BadParse);
 }
+
+
+TEST_CASE("Tokens") {
+	Lexer lexer(Source{"if elsewhere pfor downto returns + - == = != ! <= < >= > && || & | _x9 \"+\" 42"});
+	std::vector<Token::Category> categories;
+	std::vector<std::string> texts;
+	for (auto t = lexer.next(); t.category != Token::Eof; t = lexer.next()) {
+		categories.push_back(t.category);
+		texts.push_back(t.text);
+	}
+	std::vector<Token::Category> correct{
+		Token::If, Token::Identifier, Token::PFor, Token::DownTo, Token::Identifier, Token::Plus, Token::Minus,
+		Token::Eq, Token::Assign, Token::NotEq, Token::Not, Token::LessEq, Token::Less, Token::GreaterEq,
+		Token::Greater, Token::And, Token::Or, Token::Error, Token::Error, Token::Identifier, Token::StringLit,
+		Token::NumericLit};
+	REQUIRE(categories == correct);
+	REQUIRE(texts[7] == "==");
+	REQUIRE(texts[17] == "&");
+
+	// a string which looks like an operator is none
+	REQUIRE(Token(Token::StringLit, "+", 1).isOperator() == false);
+	REQUIRE(Token(Token::Plus, "+", 1).isOperator());
+	REQUIRE(Token(Token::While, "while", 1).isKeyword());
+}
+
+TEST_CASE("Scanning") {
+	// every byte at every offset of a block, the runs end on all its positions
+	std::string alphabet = " \t\n\r\v\f_azAZ09@[`{/:\"\\+\x80\xff";
+	for (std::size_t length = 0; length < 70; length++) {
+		for (auto stop : alphabet) {
+			for (auto fill : alphabet) {
+				std::string text(length, fill);
+				text += stop;
+				text += std::string(40, fill);
+
+				int lines = 0, expected = 0;
+				std::size_t end = 0;
+				for (; end < text.size() && scan::space(text[end]); end++) {
+					expected += text[end] == '\n';
+				}
+				REQUIRE(scan::spaces(text, 0, lines) == end);
+				REQUIRE(lines == expected);
+
+				for (end = 0; end < text.size() && scan::word(text[end]); end++) {}
+				REQUIRE(scan::word(text, 0) == end);
+
+				for (end = 0; end < text.size() && scan::plain(text[end]); end++) {}
+				REQUIRE(scan::plain(text, 0) == end);
+			}
+		}
+	}
+
+	std::string gap(100, ' ');
+	std::string name(100, 'x');
+	std::string text(100, 'y');
+	Lexer lexer(Source{gap + "\n\n" + gap + name + gap + "\n\"" + text + "\\n\\\"\n" + gap + "1"});
+	Token t = lexer.next();
+	REQUIRE(t.category == Token::Identifier);
+	REQUIRE(t.text == name);
+	REQUIRE(t.line == 3);
+	t = lexer.next();
+	REQUIRE(t.category == Token::StringLit);
+	REQUIRE(t.text == text + "\n\\");
+	REQUIRE(t.line == 4);
+	t = lexer.next();
+	REQUIRE(t.category == Token::NumericLit);
+	REQUIRE(t.line == 5);
+}
+
+TEST_CASE("Chunks") {
+	std::string source;
+	for (int i = 0; i < 3000; i++) {
+		auto n = std::to_string(i);
+		source += "func F" + n + "(a) (\n\t(var s \"func ( var\\ x\\n\")\n\t(return (+ a " + n + "))\n)\n";
+		source += (i % 7 == 0) ? "var v" + n + "\n" : "var v" + n + " F" + n + "(1)\n\n";
+	}
+	source += "F7(2)";
+	auto print = [](Toplevel &tl) {
+		std::stringstream out;
+		out << tl;
+		for (auto &global : tl.globals) {
+			if (global.is<Func>()) {
+				out << global.get<Func>().name.token.line << " ";
+			}
+		}
+		return out.str();
+	};
+
+	Parser one(Source{source});
+	auto whole = one.toplevel();
+	Parser many(Source{source});
+	many.workers = 4;
+	auto chunked = many.toplevel();
+	REQUIRE(whole.globals.size() == 6001);
+	REQUIRE(print(chunked) == print(whole));
+	REQUIRE(many.stringTable.stringTable == one.stringTable.stringTable);
+
+	// the error is the one found in the whole source
+	std::string broken = source;
+	broken.insert(broken.find("func F2000"), "var x (+ 1\n");
+	BadParse error(Token(Token::Eof, "", 0), ""), chunkedError(Token(Token::Eof, "", 0), "");
+	try {
+		Parser(Source{broken}).toplevel();
+	}
+	catch (BadParse e) {
+		error = e;
+	}
+	try {
+		Parser parser(Source{broken});
+		parser.workers = 4;
+		parser.toplevel();
+	}
+	catch (BadParse e) {
+		chunkedError = e;
+	}
+	REQUIRE(error.found.category == Token::Func);
+	REQUIRE(chunkedError.found.line == error.found.line);
+	REQUIRE(chunkedError.expected == error.expected);
+}
\ No newline at end of file